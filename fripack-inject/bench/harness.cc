@@ -0,0 +1,664 @@
+// Loads a built libfripack-inject.so with synthetic embedded configs and
+// reports startup, message throughput, reload latency and a QuickJS/V8
+// comparison (startup, per-call hook overhead, memory) as JSON.
+//
+//   xmake build fripack-inject fripack-harness
+//   xmake run fripack-harness build/linux/x86_64/release/libfripack-inject.so
+//
+// For every scenario a copy of the library gets the config appended as an
+// extra PT_LOAD segment (taking over the PT_NOTE program header) and
+// g_embedded_config patched to point at it. The copy is then dlopen()ed in a
+// forked child, so each measurement starts from a cold process. The agent's
+// log output on stdout is piped back into the child and scanned for the
+// lines the measurements need.
+//
+// Linux, ELF64 only.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <lzma.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+extern "C" {
+// Targets for the harness scripts. Exported with -rdynamic so scripts can
+// find them with Module.getGlobalExportByName().
+__attribute__((visibility("default"))) volatile uint32_t fripack_harness_flag;
+
+__attribute__((visibility("default"), noinline)) void
+fripack_harness_probe(volatile uint32_t *flag) {
+  asm volatile("" : : "r"(flag) : "memory");
+}
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+constexpr auto kTimeout = std::chrono::seconds(30);
+
+struct Options {
+  std::string library;
+  size_t payload_kb = 512;
+  size_t messages = 20000;
+  size_t reloads = 20;
+};
+
+#pragma pack(push, 1)
+struct EmbeddedConfigHeader {
+  int32_t magic1;
+  int32_t magic2;
+  int32_t version;
+  int32_t data_size;
+  int32_t data_offset;
+  uint8_t codec;
+  uint64_t uncompressed_size;
+};
+#pragma pack(pop)
+
+int64_t elapsed_us(Clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               since)
+      .count();
+}
+
+std::string json_escape(std::string_view in) {
+  std::string out;
+  out.reserve(in.size() + 16);
+  for (char c : in) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out += fmt::format("\\u{:04x}", c);
+      } else {
+        out.push_back(c);
+      }
+    }
+  }
+  return out;
+}
+
+// Realistic-looking filler so compile time scales with bundle size.
+std::string filler(size_t bytes) {
+  std::string out;
+  for (size_t i = 0; out.size() < bytes; ++i) {
+    out += fmt::format("function f{0}(a, b) {{ const t = (a * {0}) ^ (b >>> "
+                       "3); return t + '{0}'.length; }}\n",
+                       i);
+  }
+  return out;
+}
+
+std::string xz_compress(const std::string &in) {
+  std::string out(lzma_stream_buffer_bound(in.size()), '\0');
+  size_t out_pos = 0;
+  if (lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, nullptr,
+                              reinterpret_cast<const uint8_t *>(in.data()),
+                              in.size(), reinterpret_cast<uint8_t *>(out.data()),
+                              &out_pos, out.size()) != LZMA_OK) {
+    throw std::runtime_error("xz compression failed");
+  }
+  out.resize(out_pos);
+  return out;
+}
+
+template <typename T> T read_at(const std::string &image, uint64_t offset) {
+  T value;
+  std::memcpy(&value, image.data() + offset, sizeof(T));
+  return value;
+}
+
+// Writes a copy of the library with config appended in a new PT_LOAD segment
+// and g_embedded_config pointing at it.
+void patch_library(const std::string &library, const std::string &output,
+                   const std::string &config, uint8_t codec,
+                   uint64_t uncompressed_size) {
+  std::ifstream in(library, std::ios::binary);
+  std::string image((std::istreambuf_iterator<char>(in)),
+                    std::istreambuf_iterator<char>());
+  if (image.size() < sizeof(Elf64_Ehdr) ||
+      std::memcmp(image.data(), ELFMAG, SELFMAG) != 0 ||
+      image[EI_CLASS] != ELFCLASS64) {
+    throw std::runtime_error("not an ELF64 library: " + library);
+  }
+
+  auto ehdr = read_at<Elf64_Ehdr>(image, 0);
+  std::vector<Elf64_Phdr> phdrs(ehdr.e_phnum);
+  for (size_t i = 0; i < phdrs.size(); ++i) {
+    phdrs[i] = read_at<Elf64_Phdr>(image, ehdr.e_phoff + i * ehdr.e_phentsize);
+  }
+
+  auto vaddr_to_offset = [&](uint64_t vaddr) -> uint64_t {
+    for (const auto &ph : phdrs) {
+      if (ph.p_type == PT_LOAD && vaddr >= ph.p_vaddr &&
+          vaddr < ph.p_vaddr + ph.p_filesz) {
+        return vaddr - ph.p_vaddr + ph.p_offset;
+      }
+    }
+    throw std::runtime_error("address not backed by the file");
+  };
+
+  std::optional<uint64_t> symbol_vaddr;
+  for (size_t i = 0; i < ehdr.e_shnum && !symbol_vaddr; ++i) {
+    auto sh = read_at<Elf64_Shdr>(image, ehdr.e_shoff + i * ehdr.e_shentsize);
+    if (sh.sh_type != SHT_DYNSYM) {
+      continue;
+    }
+    auto strtab =
+        read_at<Elf64_Shdr>(image, ehdr.e_shoff + sh.sh_link * ehdr.e_shentsize);
+    for (uint64_t off = 0; off + sizeof(Elf64_Sym) <= sh.sh_size;
+         off += sizeof(Elf64_Sym)) {
+      auto sym = read_at<Elf64_Sym>(image, sh.sh_offset + off);
+      if (std::strcmp(image.data() + strtab.sh_offset + sym.st_name,
+                      "g_embedded_config") == 0) {
+        symbol_vaddr = sym.st_value;
+        break;
+      }
+    }
+  }
+  if (!symbol_vaddr) {
+    throw std::runtime_error("g_embedded_config not found in .dynsym");
+  }
+
+  auto note = std::find_if(phdrs.begin(), phdrs.end(), [](const auto &ph) {
+    return ph.p_type == PT_NOTE;
+  });
+  if (note == phdrs.end()) {
+    throw std::runtime_error("no PT_NOTE program header to repurpose");
+  }
+  phdrs.erase(note);
+
+  constexpr uint64_t kAlign = 0x10000;
+  uint64_t end_vaddr = 0;
+  for (const auto &ph : phdrs) {
+    if (ph.p_type == PT_LOAD) {
+      end_vaddr = std::max(end_vaddr, ph.p_vaddr + ph.p_memsz);
+    }
+  }
+
+  Elf64_Phdr load{};
+  load.p_type = PT_LOAD;
+  load.p_flags = PF_R;
+  load.p_offset = (image.size() + kAlign - 1) & ~(kAlign - 1);
+  load.p_vaddr = load.p_paddr = (end_vaddr + kAlign - 1) & ~(kAlign - 1);
+  load.p_filesz = load.p_memsz = config.size();
+  load.p_align = kAlign;
+
+  // The loader expects PT_LOAD entries in ascending address order.
+  auto last_load = std::find_if(phdrs.rbegin(), phdrs.rend(), [](const auto &ph) {
+    return ph.p_type == PT_LOAD;
+  });
+  phdrs.insert(last_load.base(), load);
+  for (size_t i = 0; i < phdrs.size(); ++i) {
+    std::memcpy(image.data() + ehdr.e_phoff + i * ehdr.e_phentsize, &phdrs[i],
+                sizeof(Elf64_Phdr));
+  }
+
+  EmbeddedConfigHeader header{0x0d000721,
+                              0x1f8a4e2b,
+                              2,
+                              static_cast<int32_t>(config.size()),
+                              static_cast<int32_t>(load.p_vaddr - *symbol_vaddr),
+                              codec,
+                              uncompressed_size};
+  std::memcpy(image.data() + vaddr_to_offset(*symbol_vaddr), &header,
+              sizeof(header));
+
+  image.resize(load.p_offset, '\0');
+  image += config;
+  std::ofstream out(output, std::ios::binary | std::ios::trunc);
+  out.write(image.data(), image.size());
+}
+
+// Reads the agent's stdout in the child and remembers matching lines.
+class LogTap {
+public:
+  LogTap() {
+    int fds[2];
+    if (pipe(fds) == -1) {
+      throw std::runtime_error("pipe failed");
+    }
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    thread_ = std::thread([this, fd = fds[0]]() { run(fd); });
+    thread_.detach();
+  }
+
+  std::atomic<uint64_t> console_messages{0};
+  std::atomic<int64_t> decode_us{-1};
+  std::atomic<bool> v8_fallback{false};
+
+private:
+  void run(int fd) {
+    std::string pending;
+    char buffer[64 * 1024];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+      pending.append(buffer, n);
+      size_t start = 0, end;
+      while ((end = pending.find('\n', start)) != std::string::npos) {
+        on_line(std::string_view(pending).substr(start, end - start));
+        start = end + 1;
+      }
+      pending.erase(0, start);
+    }
+  }
+
+  void on_line(std::string_view line) {
+    if (line.find("log: fpmsg") != std::string_view::npos) {
+      console_messages.fetch_add(1, std::memory_order_relaxed);
+    } else if (line.find("V8 runtime not available") !=
+               std::string_view::npos) {
+      v8_fallback = true;
+    } else if (auto pos = line.find("Decoded embedded config:");
+               pos != std::string_view::npos) {
+      auto in = line.find(" in ", pos);
+      if (in != std::string_view::npos) {
+        decode_us = std::strtoll(line.data() + in + 4, nullptr, 10);
+      }
+    }
+  }
+
+  std::thread thread_;
+};
+
+bool wait_until(const std::function<bool()> &done) {
+  auto deadline = Clock::now() + kTimeout;
+  while (!done()) {
+    if (Clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+void *load(const std::string &library) {
+  void *handle = dlopen(library.c_str(), RTLD_NOW);
+  if (!handle) {
+    throw std::runtime_error(fmt::format("dlopen failed: {}", dlerror()));
+  }
+  return handle;
+}
+
+constexpr const char *kHookScript = R"(
+const probe = Module.getGlobalExportByName('fripack_harness_probe');
+Interceptor.attach(probe, {
+  onEnter(args) {
+    args[0].writeU32(1);
+  }
+});
+)";
+
+// Per-call cost of hooks on each runtime. args[0] selects what onEnter
+// does: 0 marks the hook live, 2 returns straight away, 3 does some
+// arithmetic the way a script hashing a buffer would.
+constexpr const char *kRuntimeScript = R"(
+const probe = Module.getGlobalExportByName('fripack_harness_probe');
+Interceptor.attach(probe, {
+  onEnter(args) {
+    const mode = args[0].readU32();
+    if (mode === 0) {
+      args[0].writeU32(1);
+    } else if (mode === 3) {
+      let h = 0x811c9dc5;
+      for (let i = 0; i < 1024; i++) {
+        h = Math.imul(h ^ (i & 0xff), 16777619);
+      }
+      args[0].writeU32(h >>> 0);
+    }
+  }
+});
+)";
+
+// VmRSS and VmHWM in KiB.
+std::pair<double, double> memory_usage() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  double rss = 0, hwm = 0;
+  while (std::getline(status, line)) {
+    if (line.starts_with("VmRSS:")) {
+      rss = std::strtod(line.c_str() + 6, nullptr);
+    } else if (line.starts_with("VmHWM:")) {
+      hwm = std::strtod(line.c_str() + 6, nullptr);
+    }
+  }
+  return {rss, hwm};
+}
+
+double ns_per_call(uint32_t mode, size_t calls) {
+  volatile uint32_t arg;
+  auto start = Clock::now();
+  for (size_t i = 0; i < calls; ++i) {
+    arg = mode;
+    fripack_harness_probe(&arg);
+  }
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+             .count() /
+         calls;
+}
+
+std::map<std::string, double> run_runtime(const Options &options,
+                                          const std::string &dir,
+                                          const char *runtime) {
+  std::string config =
+      fmt::format(R"({{"mode":"EmbedJs","runtime":"{}","js_content":"{}"}})",
+                  runtime,
+                  json_escape(filler(options.payload_kb * 1024) +
+                              kRuntimeScript));
+  std::string library = dir + "/runtime.so";
+  patch_library(options.library, library, config, 0, config.size());
+
+  constexpr size_t kCalls = 100000;
+  double native_ns = ns_per_call(2, kCalls);
+  auto [rss_before, hwm_before] = memory_usage();
+
+  LogTap tap;
+  volatile uint32_t hooked = 0;
+  auto start = Clock::now();
+  load(library);
+  if (!wait_until([&]() {
+        hooked = 0;
+        fripack_harness_probe(&hooked);
+        return hooked != 0;
+      })) {
+    throw std::runtime_error("hook never fired");
+  }
+  double first_hook = elapsed_us(start);
+
+  ns_per_call(2, kCalls / 10); // Warm up, and let a JIT kick in.
+  double empty_hook_ns = ns_per_call(2, kCalls);
+  double compute_hook_ns = ns_per_call(3, kCalls / 10);
+  auto [rss, hwm] = memory_usage();
+
+  return {{"v8_fallback", tap.v8_fallback ? 1.0 : 0.0},
+          {"time_to_first_hook_us", first_hook},
+          {"native_call_ns", native_ns},
+          {"empty_hook_ns", empty_hook_ns - native_ns},
+          {"compute_hook_ns", compute_hook_ns - native_ns},
+          {"rss_delta_kb", rss - rss_before},
+          {"hwm_delta_kb", hwm - hwm_before}};
+}
+
+struct Scenario {
+  std::string name;
+  std::function<std::map<std::string, double>(const Options &,
+                                              const std::string &)>
+      run;
+};
+
+std::string embed_js_config(const std::string &script) {
+  return fmt::format(R"({{"mode":"EmbedJs","js_content":"{}"}})",
+                     json_escape(script));
+}
+
+std::map<std::string, double> run_startup(const Options &options,
+                                          const std::string &dir, bool xz) {
+  std::string config =
+      embed_js_config(filler(options.payload_kb * 1024) + kHookScript);
+  std::string data = xz ? xz_compress(config) : config;
+  std::string library = dir + "/startup.so";
+  patch_library(options.library, library, data, xz ? 1 : 0, config.size());
+
+  auto [rss_before, hwm_before] = memory_usage();
+  LogTap tap;
+  volatile uint32_t hooked = 0;
+  auto start = Clock::now();
+  load(library);
+  if (!wait_until([&]() {
+        fripack_harness_probe(&hooked);
+        return hooked != 0;
+      })) {
+    throw std::runtime_error("hook never fired");
+  }
+  double first_hook = elapsed_us(start);
+  wait_until([&]() { return tap.decode_us >= 0; });
+  auto [rss, hwm] = memory_usage();
+
+  return {{"config_bytes", static_cast<double>(config.size())},
+          {"embedded_bytes", static_cast<double>(data.size())},
+          {"time_to_first_hook_us", first_hook},
+          {"config_decode_us", static_cast<double>(tap.decode_us)},
+          {"rss_delta_kb", rss - rss_before},
+          {"hwm_delta_kb", hwm - hwm_before}};
+}
+
+std::map<std::string, double> run_throughput(const Options &options,
+                                             const std::string &dir) {
+  std::string script = fmt::format(R"(
+const probe = Module.getGlobalExportByName('fripack_harness_probe');
+Interceptor.attach(probe, {{
+  onEnter(args) {{
+    args[0].writeU32(1);
+    for (let i = 0; i < {}; i++) {{
+      console.log('fpmsg ' + i);
+    }}
+  }}
+}});
+)",
+                                   options.messages);
+  std::string library = dir + "/throughput.so";
+  std::string config = embed_js_config(script);
+  patch_library(options.library, library, config, 0, config.size());
+
+  LogTap tap;
+  volatile uint32_t hooked = 0;
+  void *handle = load(library);
+  // Delivery is counted by the message thread rather than from log lines:
+  // the logger drops lines when its queue is full, and a burst this size
+  // fills it.
+  auto message_stats = reinterpret_cast<size_t (*)(char *, size_t)>(
+      dlsym(handle, "fripack_message_stats"));
+  if (!message_stats) {
+    throw std::runtime_error("fripack_message_stats not exported");
+  }
+  auto handled = [&]() -> uint64_t {
+    char json[512];
+    message_stats(json, sizeof(json));
+    const char *field = std::strstr(json, "\"handled\":");
+    return field ? std::strtoull(field + 10, nullptr, 10) : 0;
+  };
+  // Poll the probe until the hook is live; the call that first hits it runs
+  // the whole burst synchronously inside onEnter.
+  Clock::time_point start;
+  if (!wait_until([&]() {
+        start = Clock::now();
+        fripack_harness_probe(&hooked);
+        return hooked != 0;
+      })) {
+    throw std::runtime_error("hook never fired");
+  }
+  // Timing continues until the last message has been handled.
+  if (!wait_until([&]() { return handled() >= options.messages; })) {
+    throw std::runtime_error(fmt::format("only {} of {} messages handled",
+                                         handled(), options.messages));
+  }
+  double elapsed = elapsed_us(start);
+
+  return {{"messages", static_cast<double>(options.messages)},
+          {"handled", static_cast<double>(handled())},
+          {"logged", static_cast<double>(tap.console_messages)},
+          {"elapsed_us", elapsed},
+          {"messages_per_sec", options.messages / (elapsed / 1e6)}};
+}
+
+std::map<std::string, double> run_reload(const Options &options,
+                                         const std::string &dir) {
+  std::string script_path = dir + "/watched.js";
+  auto write_script = [&](uint32_t generation) {
+    std::string tmp = script_path + ".tmp";
+    std::ofstream(tmp, std::ios::trunc)
+        << filler(options.payload_kb * 1024)
+        << fmt::format("Module.getGlobalExportByName('fripack_harness_flag')"
+                       ".writeU32({});\n",
+                       generation);
+    std::filesystem::rename(tmp, script_path);
+  };
+  write_script(1);
+
+  std::string library = dir + "/reload.so";
+  std::string config = fmt::format(R"({{"mode":"WatchPath","watch_path":"{}"}})",
+                                   json_escape(script_path));
+  patch_library(options.library, library, config, 0, config.size());
+
+  LogTap tap;
+  load(library);
+  if (!wait_until([]() { return fripack_harness_flag == 1; })) {
+    throw std::runtime_error("initial script never ran");
+  }
+
+  std::vector<double> latencies;
+  for (uint32_t generation = 2; generation < options.reloads + 2;
+       ++generation) {
+    // Let the debounce window of the previous save pass.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto start = Clock::now();
+    write_script(generation);
+    if (!wait_until([&]() { return fripack_harness_flag == generation; })) {
+      throw std::runtime_error("reload never happened");
+    }
+    latencies.push_back(elapsed_us(start));
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[std::min(latencies.size() - 1,
+                              static_cast<size_t>(p * latencies.size()))];
+  };
+  return {{"reloads", static_cast<double>(latencies.size())},
+          {"reload_median_us", percentile(0.5)},
+          {"reload_p90_us", percentile(0.9)},
+          {"reload_max_us", latencies.back()}};
+}
+
+// Runs one scenario in a forked child and returns its JSON object.
+std::string run_isolated(const Scenario &scenario, const Options &options) {
+  auto dir = std::filesystem::temp_directory_path() /
+             fmt::format("fripack-harness-{}-{}", getpid(), scenario.name);
+  std::filesystem::create_directories(dir);
+
+  int fds[2];
+  if (pipe(fds) == -1) {
+    throw std::runtime_error("pipe failed");
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    std::string result;
+    try {
+      std::string metrics;
+      for (const auto &[key, value] : scenario.run(options, dir.string())) {
+        metrics += fmt::format(",\"{}\":{}", key, value);
+      }
+      result = fmt::format(R"({{"name":"{}","ok":true{}}})", scenario.name,
+                           metrics);
+    } catch (const std::exception &e) {
+      result = fmt::format(R"({{"name":"{}","ok":false,"error":"{}"}})",
+                           scenario.name, json_escape(e.what()));
+    }
+    (void)!write(fds[1], result.data(), result.size());
+    close(fds[1]);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  std::string result;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+    result.append(buffer, n);
+  }
+  close(fds[0]);
+  waitpid(pid, nullptr, 0);
+  std::filesystem::remove_all(dir);
+
+  if (result.empty()) {
+    result = fmt::format(R"({{"name":"{}","ok":false,"error":"crashed"}})",
+                         scenario.name);
+  }
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() { return i + 1 < argc ? std::stoul(argv[++i]) : 0; };
+    if (arg == "--payload-kb") {
+      options.payload_kb = next();
+    } else if (arg == "--messages") {
+      options.messages = next();
+    } else if (arg == "--reloads") {
+      options.reloads = std::max<size_t>(next(), 1);
+    } else {
+      options.library = arg;
+    }
+  }
+  if (options.library.empty()) {
+    fmt::print(stderr,
+               "Usage: {} <libfripack-inject.so> [--payload-kb N] "
+               "[--messages N] [--reloads N]\n",
+               argv[0]);
+    return 2;
+  }
+
+  std::vector<Scenario> scenarios = {
+      {"startup", [](const Options &o,
+                     const std::string &d) { return run_startup(o, d, false); }},
+      {"startup-xz", [](const Options &o,
+                        const std::string &d) { return run_startup(o, d, true); }},
+      {"throughput", run_throughput},
+      {"reload", run_reload},
+      {"runtime-quickjs",
+       [](const Options &o, const std::string &d) {
+         return run_runtime(o, d, "QuickJs");
+       }},
+      {"runtime-v8",
+       [](const Options &o, const std::string &d) {
+         return run_runtime(o, d, "V8");
+       }},
+  };
+
+  std::string results;
+  for (const auto &scenario : scenarios) {
+    if (!results.empty()) {
+      results += ",";
+    }
+    results += run_isolated(scenario, options);
+  }
+
+  fmt::print(R"({{"library":"{}","payload_kb":{},"scenarios":[{}]}})"
+             "\n",
+             json_escape(options.library), options.payload_kb, results);
+  return 0;
+}
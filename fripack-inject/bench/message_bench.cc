@@ -0,0 +1,81 @@
+// Compares the per-message cost of the JSON DOM walk on_message used to do
+// for every script message against the prefix-sniffing fast path.
+//
+//   xmake build fripack-bench-message && xmake run fripack-bench-message
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "frida-gumjs.h"
+
+#include "message.h"
+
+namespace {
+
+std::vector<std::string> sample_messages() {
+  return {
+      R"({"type":"log","level":"info","payload":"open(\"/data/data/com.example/files/a.db\", 0x2) = 42"})",
+      R"({"type":"log","level":"info","payload":"SSL_write len=512 buf=7b2274797065223a2270696e67227d"})",
+      R"({"type":"log","level":"warning","payload":"slow path taken\n  at foo [script:12]"})",
+      R"({"type":"send","payload":{"event":"recv","fd":17,"len":1024,"ts":1712345678901}})",
+      R"({"type":"send","payload":["hook","libc.so!connect",3,"10.0.0.1:443"]})",
+  };
+}
+
+size_t classify_dom(const std::string &message) {
+  size_t bytes = 0;
+  JsonParser *parser = json_parser_new();
+  if (json_parser_load_from_data(parser, message.c_str(), -1, nullptr)) {
+    JsonObject *root = json_node_get_object(json_parser_get_root(parser));
+    const gchar *type = json_object_get_string_member(root, "type");
+    if (type && strcmp(type, "log") == 0) {
+      bytes = strlen(json_object_get_string_member(root, "payload"));
+    } else {
+      bytes = message.size();
+    }
+  }
+  g_object_unref(parser);
+  return bytes;
+}
+
+size_t classify_fast(const std::string &message) {
+  fripack::message::Message parsed;
+  if (!fripack::message::classify(message, parsed)) {
+    return classify_dom(message);
+  }
+  return parsed.type == fripack::message::Type::Log ? parsed.text.size()
+                                                    : message.size();
+}
+
+template <typename F>
+double run(const char *name, const std::vector<std::string> &messages,
+           size_t iterations, F &&classify) {
+  size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    sink += classify(messages[i % messages.size()]);
+  }
+  auto elapsed = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  double rate = iterations / elapsed;
+  fmt::print("{:>6}: {:>12.0f} msg/s  ({:.1f} ns/msg, checksum {})\n", name,
+             rate, elapsed * 1e9 / iterations, sink);
+  return rate;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000000;
+  auto messages = sample_messages();
+
+  double dom = run("dom", messages, iterations, classify_dom);
+  double fast = run("fast", messages, iterations, classify_fast);
+  fmt::print("speedup: {:.1f}x\n", fast / dom);
+  return 0;
+}
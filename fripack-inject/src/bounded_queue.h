@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace fripack {
+// Fixed-capacity lock-free queue (Vyukov's bounded MPMC design). Any thread
+// may push or pop; neither ever blocks, and push reports failure when full.
+// Capacity must be a power of two.
+template <typename T, size_t Capacity> class BoundedQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+public:
+  BoundedQueue() {
+    for (size_t i = 0; i < Capacity; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  bool try_push(T &&value) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & (Capacity - 1)];
+      size_t seq = slot->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->value = std::move(value);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> try_pop() {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & (Capacity - 1)];
+      size_t seq = slot->sequence.load(std::memory_order_acquire);
+      auto diff =
+          static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return std::nullopt;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    std::optional<T> value(std::move(slot->value));
+    slot->value = T{};
+    slot->sequence.store(pos + Capacity, std::memory_order_release);
+    return value;
+  }
+
+  // Approximate; only exact while no other thread is pushing or popping.
+  bool empty() const {
+    return enqueue_pos_.load(std::memory_order_seq_cst) ==
+           dequeue_pos_.load(std::memory_order_seq_cst);
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  static constexpr size_t kCacheLine = 64;
+
+  Slot slots_[Capacity];
+  alignas(kCacheLine) std::atomic<size_t> enqueue_pos_{0};
+  alignas(kCacheLine) std::atomic<size_t> dequeue_pos_{0};
+};
+} // namespace fripack
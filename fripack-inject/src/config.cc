@@ -1,9 +1,23 @@
 #include "config.h"
+#include "export.h"
 #include "logger.h"
 
+#include <lz4.h>
 #include <lzma.h>
 #include <rfl.hpp>
 #include <rfl/json.hpp>
+#include <zstd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string_view>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <link.h>
+#endif
 
 
 namespace fripack::config {
@@ -35,114 +49,301 @@ void print_hexdump(const uint8_t *data, size_t size) {
     res += "|\n";
   }
 
-  logger::println("\n{}", res);
+  logger::error("\n{}", res);
 }
 
+enum class Codec : uint8_t {
+  None = 0,
+  Xz = 1,
+  Zstd = 2,
+  Lz4 = 3,
+};
+
 #pragma pack(push, 1)
 struct EmbeddedConfig {
   int32_t magic1 = 0x0d000721;
   int32_t magic2 = 0x1f8a4e2b;
-  int32_t version = 1;
+  int32_t version = 3;
 
   int32_t data_size = 0;
   int32_t data_offset = 0; // Offset from the start of the struct.
-  bool data_xz = false;    // Whether the data is compressed with xz.
+  // v1 stores a bool "data is xz" here, which maps onto Codec::None/Xz.
+  Codec codec = Codec::None;
+  // v2: size of the data once decoded, so it can be decoded in one go into
+  // a buffer of the right size.
+  uint64_t uncompressed_size = 0;
+  // v3: how long the library constructor waits for the scripts to load, in
+  // milliseconds. In the header so it is known before anything is decoded.
+  uint32_t wait_for_load_ms = 0;
 };
 #pragma pack(pop)
 
-#ifdef _WIN32
-#define EXPORT __declspec(dllexport)
-#else
-#define EXPORT __attribute__((visibility("default")))
-#endif
-
 EXPORT EmbeddedConfig g_embedded_config{};
 
-const EmbeddedConfigData &configData() {
-  static std::optional<EmbeddedConfigData> config_data;
-
-  if (!config_data) {
-    if (g_embedded_config.magic1 != 0x0d000721 ||
-        g_embedded_config.magic2 != 0x1f8a4e2b ||
-        g_embedded_config.version != 1) {
-      logger::println("Invalid embedded config");
-      print_hexdump(reinterpret_cast<const uint8_t *>(&g_embedded_config),
-                    sizeof(g_embedded_config));
-      throw std::runtime_error("Invalid embedded config");
-    }
+namespace {
+constexpr size_t max_decoded_size = 300 * 1024 * 1024;
+
+struct DecodedBuffer {
+  std::unique_ptr<char[]> data;
+  size_t size = 0;
+};
+
+// Decodes v1 xz data, whose decoded size is unknown, into a single buffer
+// that starts at a guess and doubles as needed.
+DecodedBuffer decode_xz_unsized(const char *src, size_t src_size) {
+  lzma_stream strm = LZMA_STREAM_INIT;
+  lzma_ret ret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+  if (ret != LZMA_OK) {
+    logger::error("Failed to initialize LZMA decoder: {}",
+                  rfl::enum_to_string(ret));
+    lzma_end(&strm);
+    throw std::runtime_error("Failed to initialize LZMA decoder");
+  }
+
+  size_t capacity = std::max<size_t>(src_size * 4, 64 * 1024);
+  DecodedBuffer out{std::unique_ptr<char[]>(new char[capacity]), 0};
 
-    std::vector<char> data(g_embedded_config.data_size);
-    char *p_embedded_config_data =
-        reinterpret_cast<char *>(&g_embedded_config) +
-        g_embedded_config.data_offset;
-    std::memcpy(data.data(), p_embedded_config_data,
-                g_embedded_config.data_size);
+  strm.next_in = reinterpret_cast<const uint8_t *>(src);
+  strm.avail_in = src_size;
+  while (true) {
+    strm.next_out = reinterpret_cast<uint8_t *>(out.data.get() + out.size);
+    strm.avail_out = capacity - out.size;
 
-    if (g_embedded_config.data_xz) {
-      lzma_stream strm = LZMA_STREAM_INIT;
+    ret = lzma_code(&strm, LZMA_FINISH);
+    out.size = capacity - strm.avail_out;
 
-      lzma_ret ret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
-      if (ret != LZMA_OK) {
-        logger::println("Failed to initialize LZMA decoder: {}",
-                        rfl::enum_to_string(ret));
+    if (ret == LZMA_STREAM_END) {
+      break;
+    } else if (ret != LZMA_OK && ret != LZMA_BUF_ERROR) {
+      logger::error("LZMA decompression failed: {}", rfl::enum_to_string(ret));
+      lzma_end(&strm);
+      throw std::runtime_error("LZMA decompression failed");
+    } else if (strm.avail_out == 0) {
+      if (capacity >= max_decoded_size) {
+        logger::error("Decompressed data too large (> {} MB)",
+                      max_decoded_size / (1024 * 1024));
         lzma_end(&strm);
-        throw std::runtime_error("Failed to initialize LZMA decoder");
+        throw std::runtime_error("Decompressed data too large");
       }
+      size_t grown = std::min(capacity * 2, max_decoded_size);
+      std::unique_ptr<char[]> bigger(new char[grown]);
+      std::memcpy(bigger.get(), out.data.get(), out.size);
+      out.data = std::move(bigger);
+      capacity = grown;
+    } else if (strm.avail_in == 0) {
+      break;
+    }
+  }
 
-      strm.next_in = reinterpret_cast<const uint8_t *>(data.data());
-      strm.avail_in = data.size();
-
-      std::vector<char> decompressed_data{};
-      constexpr size_t chunk_size = 64 * 1024;
-      constexpr size_t max_size = 300 * 1024 * 1024;
+  lzma_end(&strm);
+  return out;
+}
 
-      while (true) {
-        std::vector<char> chunk(chunk_size);
-        strm.next_out = reinterpret_cast<uint8_t *>(chunk.data());
-        strm.avail_out = chunk.size();
+// Decodes into dst, which must be exactly the decoded size.
+void decode_into(Codec codec, const char *src, size_t src_size, char *dst,
+                 size_t dst_size) {
+  switch (codec) {
+  case Codec::None:
+    if (src_size != dst_size) {
+      throw std::runtime_error("Stored data size mismatch");
+    }
+    std::memcpy(dst, src, src_size);
+    return;
+  case Codec::Xz: {
+    uint64_t memlimit = UINT64_MAX;
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+    lzma_ret ret = lzma_stream_buffer_decode(
+        &memlimit, 0, nullptr, reinterpret_cast<const uint8_t *>(src),
+        &in_pos, src_size, reinterpret_cast<uint8_t *>(dst), &out_pos,
+        dst_size);
+    if (ret != LZMA_OK || out_pos != dst_size) {
+      logger::error("LZMA decompression failed: {}", rfl::enum_to_string(ret));
+      throw std::runtime_error("LZMA decompression failed");
+    }
+    return;
+  }
+  case Codec::Zstd: {
+    size_t ret = ZSTD_decompress(dst, dst_size, src, src_size);
+    if (ZSTD_isError(ret) || ret != dst_size) {
+      logger::error("Zstd decompression failed: {}",
+                    ZSTD_isError(ret) ? ZSTD_getErrorName(ret)
+                                      : "size mismatch");
+      throw std::runtime_error("Zstd decompression failed");
+    }
+    return;
+  }
+  case Codec::Lz4: {
+    int ret = LZ4_decompress_safe(src, dst, static_cast<int>(src_size),
+                                  static_cast<int>(dst_size));
+    if (ret < 0 || static_cast<size_t>(ret) != dst_size) {
+      logger::error("LZ4 decompression failed: {}", ret);
+      throw std::runtime_error("LZ4 decompression failed");
+    }
+    return;
+  }
+  }
 
-        ret = lzma_code(&strm, LZMA_FINISH);
+  logger::error("Unknown codec {}", static_cast<int>(codec));
+  throw std::runtime_error("Unknown codec");
+}
 
-        size_t decompressed_chunk_size = chunk.size() - strm.avail_out;
-        if (decompressed_data.size() + decompressed_chunk_size > max_size) {
-          logger::println("Decompressed data too large (> {} MB)",
-                          max_size / (1024 * 1024));
-          lzma_end(&strm);
-          throw std::runtime_error("Decompressed data too large");
+// Whether [offset, offset + size) from the header lies in memory this
+// library maps from its file, so a malformed header or table of contents
+// cannot make us read outside the image.
+bool in_image(int64_t offset, uint64_t size) {
+  auto header = reinterpret_cast<uintptr_t>(&g_embedded_config);
+  uintptr_t start = header + static_cast<uintptr_t>(offset);
+  if ((offset < 0) != (start < header)) {
+    return false;
+  }
+#ifdef _WIN32
+  HMODULE module;
+  if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                              GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                          reinterpret_cast<LPCSTR>(&g_embedded_config),
+                          &module)) {
+    return false;
+  }
+  auto base = reinterpret_cast<uintptr_t>(module);
+  auto *dos = reinterpret_cast<const IMAGE_DOS_HEADER *>(module);
+  auto *nt = reinterpret_cast<const IMAGE_NT_HEADERS *>(base + dos->e_lfanew);
+  uintptr_t end = base + nt->OptionalHeader.SizeOfImage;
+  return start >= base && start <= end && size <= end - start;
+#else
+  struct Search {
+    uintptr_t header;
+    uintptr_t start;
+    uint64_t size;
+    bool found;
+  } search{header, start, size, false};
+  dl_iterate_phdr(
+      [](dl_phdr_info *info, size_t, void *data) -> int {
+        auto *search = static_cast<Search *>(data);
+        auto segment = [&](const ElfW(Phdr) &ph, uintptr_t address,
+                           uint64_t size) {
+          uintptr_t begin = info->dlpi_addr + ph.p_vaddr;
+          uintptr_t end = begin + ph.p_filesz;
+          return ph.p_type == PT_LOAD && address >= begin && address <= end &&
+                 size <= end - address;
+        };
+        bool ours = false;
+        for (size_t i = 0; i < info->dlpi_phnum && !ours; ++i) {
+          ours = segment(info->dlpi_phdr[i], search->header,
+                         sizeof(EmbeddedConfig));
+        }
+        if (!ours) {
+          return 0;
         }
+        for (size_t i = 0; i < info->dlpi_phnum; ++i) {
+          search->found = search->found || segment(info->dlpi_phdr[i],
+                                                   search->start, search->size);
+        }
+        return 1;
+      },
+      &search);
+  return search.found;
+#endif
+}
 
-        decompressed_data.insert(decompressed_data.end(), chunk.begin(),
-                                 chunk.begin() + decompressed_chunk_size);
+bool header_valid() {
+  return g_embedded_config.magic1 == 0x0d000721 &&
+         g_embedded_config.magic2 == 0x1f8a4e2b &&
+         g_embedded_config.version >= 1 && g_embedded_config.version <= 3;
+}
+} // namespace
 
-        if (ret == LZMA_STREAM_END || strm.avail_in == 0) {
-          break;
-        } else if (ret != LZMA_OK) {
-          logger::println("LZMA decompression failed: {}",
-                          rfl::enum_to_string(ret));
-          lzma_end(&strm);
-          throw std::runtime_error("LZMA decompression failed");
-        }
-      }
+uint32_t waitForLoadMs() {
+  if (!header_valid() || g_embedded_config.version < 3) {
+    return 0;
+  }
+  return g_embedded_config.wait_for_load_ms;
+}
 
-      lzma_end(&strm);
-      data = std::move(decompressed_data);
-    }
+EmbeddedConfigData readConfig() {
+  if (!header_valid()) {
+    logger::error("Invalid embedded config");
+    print_hexdump(reinterpret_cast<const uint8_t *>(&g_embedded_config),
+                  sizeof(g_embedded_config));
+    throw std::runtime_error("Invalid embedded config");
+  }
+
+  if (g_embedded_config.data_size < 0 ||
+      !in_image(g_embedded_config.data_offset, g_embedded_config.data_size)) {
+    logger::error("Embedded config data at {} ({} bytes) is out of bounds",
+                  g_embedded_config.data_offset, g_embedded_config.data_size);
+    throw std::runtime_error("Embedded config data out of bounds");
+  }
 
-    auto json_str = std::string(data.data(), data.size());
-
-    if (auto res = rfl::json::read<EmbeddedConfigData>(json_str)) {
-      config_data = res.value();
-    } else {
-      logger::println("Failed to parse embedded config data: {}",
-                      res.error().what());
-      logger::println("Embedded data hexdump:");
-      print_hexdump(reinterpret_cast<const uint8_t *>(data.data()),
-                    std::min(data.size(), static_cast<size_t>(100)));
-      throw std::runtime_error("Failed to parse embedded config data");
+  auto decode_start = std::chrono::steady_clock::now();
+  const char *embedded_data =
+      reinterpret_cast<const char *>(&g_embedded_config) +
+      g_embedded_config.data_offset;
+  size_t embedded_size = g_embedded_config.data_size;
+  size_t known_size = g_embedded_config.version >= 2
+                          ? g_embedded_config.uncompressed_size
+                          : 0;
+  if (known_size > max_decoded_size) {
+    logger::error("Decompressed data too large (> {} MB)",
+                  max_decoded_size / (1024 * 1024));
+    throw std::runtime_error("Decompressed data too large");
+  }
+
+  // Uncompressed data is parsed where it lies in the image.
+  DecodedBuffer decoded;
+  std::string_view data(embedded_data, embedded_size);
+  if (g_embedded_config.codec == Codec::Xz && !known_size) {
+    decoded = decode_xz_unsized(embedded_data, embedded_size);
+  } else if (g_embedded_config.codec != Codec::None) {
+    if (!known_size) {
+      logger::error("Codec {} requires a v2 header with the decoded size",
+                    static_cast<int>(g_embedded_config.codec));
+      throw std::runtime_error("Missing decoded size");
     }
+    decoded = {std::unique_ptr<char[]>(new char[known_size]), known_size};
+    decode_into(g_embedded_config.codec, embedded_data, embedded_size,
+                decoded.data.get(), decoded.size);
+  }
+  if (decoded.data) {
+    data = std::string_view(decoded.data.get(), decoded.size);
+  }
+
+  logger::println(
+      "[*] Decoded embedded config: {} -> {} bytes in {} us", embedded_size,
+      data.size(),
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - decode_start)
+          .count());
+
+  auto res = rfl::json::read<EmbeddedConfigData>(data);
+  if (!res) {
+    logger::error("Failed to parse embedded config data: {}",
+                  res.error().what());
+    logger::error("Embedded data hexdump:");
+    print_hexdump(reinterpret_cast<const uint8_t *>(data.data()),
+                  std::min(data.size(), static_cast<size_t>(100)));
+    throw std::runtime_error("Failed to parse embedded config data");
+  }
+  // The decoded text goes away here; the parsed strings are the only copy.
+  return std::move(res.value());
+}
+
+std::string readEmbeddedScript(const ScriptEntry &entry) {
+  if (entry.uncompressed_size > max_decoded_size) {
+    throw std::runtime_error("Embedded script too large");
+  }
+  if (!in_image(entry.offset, entry.size)) {
+    throw std::runtime_error(fmt::format(
+        "Embedded script at {} ({} bytes) is out of bounds", entry.offset,
+        entry.size));
   }
 
-  return *config_data;
+  const char *src = reinterpret_cast<const char *>(&g_embedded_config) +
+                    entry.offset;
+  std::string script(entry.uncompressed_size, '\0');
+  decode_into(static_cast<Codec>(entry.codec), src, entry.size, script.data(),
+              script.size());
+  return script;
 }
 
 }; // namespace fripack::config
\ No newline at end of file
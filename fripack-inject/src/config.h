@@ -2,17 +2,147 @@
 #include <optional>
 #include <string>
 #include <cstdint>
+#include <vector>
 
 namespace fripack::config {
+struct TraceConfig {
+  std::string path;
+  // Size of the ring in bytes (default 64 MiB).
+  std::optional<uint64_t> size_bytes;
+};
+
+struct MetricsConfig {
+  // File to publish to, "{pid}" replaced with the process id. Unset uses an
+  // anonymous memfd, reachable through /proc/<pid>/fd.
+  std::optional<std::string> path;
+  // How often the counters are refreshed (default 1000).
+  std::optional<uint32_t> interval_ms;
+};
+
+// A function counted and timed by a native listener, without going through
+// the JS engine. Give a symbol (exported or, failing that, from the symbol
+// table) or an address; with a module, the address is an offset into it.
+struct ProbeTarget {
+  // Defaults to module!symbol or the address.
+  std::optional<std::string> name;
+  std::optional<std::string> module;
+  std::optional<std::string> symbol;
+  // Hex, e.g. "0x1a2b0".
+  std::optional<std::string> address;
+  // How many leading argument words to keep from the first calls (max 8).
+  std::optional<uint32_t> sample_args;
+};
+
+struct ProbesConfig {
+  std::vector<ProbeTarget> targets;
+  // How often per-probe totals are logged (default 10 s, 0 disables).
+  std::optional<uint32_t> report_interval_ms;
+};
+
+// Script engine. V8 falls back to QuickJS in builds without it.
+enum class Runtime {
+  QuickJs,
+  V8,
+};
+
+// What to do with a script message while the message queue is full.
+enum class Backpressure {
+  DropOldest,
+  DropNewest,
+  // Stall the script's thread until the message thread makes room.
+  Block,
+};
+
+struct HookProfileConfig {
+  // How often per-callback totals are logged (default 10 s, 0 disables).
+  std::optional<uint32_t> report_interval_ms;
+};
+
+// Conditions under which a script entry is loaded. Each list matches if any
+// of its items does; an unset list always matches. Process names and
+// modules accept glob patterns.
+struct ScriptMatch {
+  std::optional<std::vector<std::string>> process;
+  // Modules loaded at startup.
+  std::optional<std::vector<std::string>> module;
+  // "arm64", "arm", "x86_64" or "x86".
+  std::optional<std::vector<std::string>> arch;
+};
+
+// A table-of-contents entry for MultiScript mode. Each script is stored and
+// compressed on its own in the embedded data and only decoded if it matches.
+struct ScriptEntry {
+  std::string name;
+  // Scripts load in ascending order; ties keep their listed order.
+  std::optional<int32_t> order;
+  std::optional<ScriptMatch> match;
+  // Overrides EmbeddedConfigData::runtime for this script.
+  std::optional<Runtime> runtime;
+  // Offset from the start of the embedded config header, like data_offset.
+  int64_t offset;
+  uint64_t size;
+  // Same ids as the header codec: 0 = none, 1 = xz, 2 = zstd, 3 = lz4.
+  uint8_t codec;
+  uint64_t uncompressed_size;
+};
+
 struct EmbeddedConfigData {
   enum class Mode : int32_t {
     EmbedJs = 1,
     WatchPath = 2,
+    EmbedBytecode = 3,
+    MultiScript = 4,
   } mode;
   std::optional<std::string> js_filepath;
   std::optional<std::string> js_content;
+  // Base64 of the bytes returned by gum_script_backend_compile_sync. Used by
+  // EmbedBytecode mode; js_content, if present, is the fallback when the
+  // runtime rejects the bytecode (e.g. a different QuickJS version).
+  std::optional<std::string> js_bytecode;
   std::optional<std::string> watch_path;
+  // Engine for the scripts (default QuickJs). Bytecode and the bytecode
+  // cache are QuickJS only.
+  std::optional<Runtime> runtime;
+  std::optional<std::vector<ScriptEntry>> scripts;
+  // Directory for compiled bytecode of watched scripts and for symbol
+  // indexes (in its symidx/ subdirectory). Unset disables both caches;
+  // cache_max_bytes bounds the bytecode cache (default 32 MiB).
+  std::optional<std::string> cache_dir;
+  std::optional<uint64_t> cache_max_bytes;
+  // Records every script message and its data blob to a ring file.
+  std::optional<TraceConfig> trace;
+  // Abstract Unix socket name for the control channel, e.g.
+  // "fripack-{pid}". Unset disables it.
+  std::optional<std::string> control_socket;
+  // Appends the startup phase timings to this file as one JSON line per
+  // process start.
+  std::optional<std::string> startup_report_path;
+  // Posts {"type":"fripack:startup","phases":{...}} to every script once they
+  // are loaded. Off by default: an untyped recv() would receive it too.
+  std::optional<bool> post_startup_phases;
+  // Native call counters, installed before the scripts load.
+  std::optional<ProbesConfig> probes;
+  // Times every Interceptor.attach() callback the scripts install. Applies
+  // to scripts loaded from source, not to precompiled bytecode.
+  std::optional<HookProfileConfig> profile_hooks;
+  // Path prefixes of files Gum maps that are read once and shared from
+  // then on (Android). Defaults to the runtime linker.
+  std::optional<std::vector<std::string>> mapped_file_cache_prefixes;
+  // Script messages are handled on their own thread behind a bounded
+  // queue; this picks what happens when it fills up (default Block).
+  std::optional<Backpressure> message_backpressure;
+  // Unloads the agent this many milliseconds after the scripts load.
+  std::optional<uint32_t> unload_after_ms;
+  // Live counters in shared memory for fripack-metrics-read.
+  std::optional<MetricsConfig> metrics;
 };
 
-const EmbeddedConfigData &configData();
+// Decodes and parses the embedded config. Nothing is cached: the caller owns
+// the result and may move the script text out of it.
+EmbeddedConfigData readConfig();
+// How long the library constructor should wait for the scripts to load, in
+// milliseconds (0 = not at all, leaving startup to the JS thread). Read from
+// the header alone, so it costs nothing; version 1 and 2 headers never wait.
+uint32_t waitForLoadMs();
+std::string readEmbeddedScript(const ScriptEntry &entry);
 } // namespace fripack::config
\ No newline at end of file
@@ -0,0 +1,418 @@
+#include "control_socket.h"
+#include "logger.h"
+#include "probe_stats.h"
+
+#include <cstring>
+
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace fripack::control {
+
+#ifdef __linux__
+namespace {
+constexpr size_t kMaxClients = 16;
+constexpr uint32_t kMaxFrameSize = 64 * 1024 * 1024;
+// How long a half-written frame may wait for a slow client before the
+// client is dropped; keeps the stream framed without blocking forever.
+constexpr int kWriteTimeoutMs = 100;
+
+void put_u32(std::string &out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+uint32_t get_u32(const char *p) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+  }
+  return value;
+}
+
+std::string make_frame(ReplyType type, std::string_view payload) {
+  std::string frame;
+  frame.reserve(5 + payload.size());
+  put_u32(frame, static_cast<uint32_t>(1 + payload.size()));
+  frame.push_back(static_cast<char>(type));
+  frame.append(payload);
+  return frame;
+}
+} // namespace
+
+struct ControlServer::Client {
+  explicit Client(uint64_t id, int fd) : id(id), fd(fd) {}
+  ~Client() { close(fd); }
+
+  // Writes a whole frame. With may_drop, a frame the socket has no room for
+  // is skipped instead of waited on.
+  bool write_frame(const std::string &frame, bool may_drop) {
+    std::lock_guard lock(write_mutex);
+    size_t written = 0;
+    while (written < frame.size()) {
+      ssize_t n = send(fd, frame.data() + written, frame.size() - written,
+                       MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n > 0) {
+        written += n;
+        continue;
+      }
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (written == 0 && may_drop) {
+          return false;
+        }
+        pollfd pfd{fd, POLLOUT, 0};
+        if (poll(&pfd, 1, kWriteTimeoutMs) > 0) {
+          continue;
+        }
+      }
+      shutdown(fd, SHUT_RDWR);
+      return false;
+    }
+    return true;
+  }
+
+  uint64_t id;
+  int fd;
+  std::string inbuf;
+  bool subscribed = false;
+  // Set once the client has shut down its side. It is no longer polled and
+  // is dropped once its last batch is answered.
+  std::atomic<bool> read_closed{false};
+  std::mutex write_mutex;
+};
+
+ControlServer::ControlServer(int listen_fd, int wake_fd, BatchHandler handler)
+    : listen_fd_(listen_fd), wake_fd_(wake_fd), handler_(std::move(handler)) {}
+
+ControlServer::~ControlServer() {
+  stop();
+  close(listen_fd_);
+  close(wake_fd_);
+}
+
+std::unique_ptr<ControlServer> ControlServer::start(std::string name,
+                                                    BatchHandler handler) {
+  if (auto pos = name.find("{pid}"); pos != std::string::npos) {
+    name.replace(pos, 5, std::to_string(getpid()));
+  }
+
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (name.empty() || name.size() >= sizeof(addr.sun_path) - 1) {
+    logger::error("Invalid control socket name: '{}'", name);
+    return nullptr;
+  }
+  // Abstract namespace: leading NUL, no filesystem entry to clean up.
+  std::memcpy(addr.sun_path + 1, name.data(), name.size());
+  socklen_t addr_len = offsetof(sockaddr_un, sun_path) + 1 + name.size();
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd == -1) {
+    logger::error("Failed to create control socket: {}", strerror(errno));
+    return nullptr;
+  }
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), addr_len) == -1 ||
+      listen(fd, 4) == -1) {
+    logger::error("Failed to bind control socket @{}: {}", name,
+                  strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+
+  int wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (wake_fd == -1) {
+    logger::error("Failed to create eventfd: {}", strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+
+  std::unique_ptr<ControlServer> server(
+      new ControlServer(fd, wake_fd, std::move(handler)));
+  server->thread_ = std::thread([server = server.get()]() { server->run(); });
+  logger::println("[*] Control socket listening on @{}", name);
+  return server;
+}
+
+void ControlServer::stop() {
+  should_stop_ = true;
+  uint64_t one = 1;
+  (void)!write(wake_fd_, &one, sizeof(one));
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  std::lock_guard lock(clients_mutex_);
+  clients_.clear();
+}
+
+void ControlServer::run() {
+  std::vector<pollfd> fds;
+  std::vector<std::shared_ptr<Client>> polled;
+
+  while (!should_stop_) {
+    fds.assign({{wake_fd_, POLLIN, 0}, {listen_fd_, POLLIN, 0}});
+    polled.clear();
+    {
+      std::lock_guard lock(clients_mutex_);
+      for (auto &[id, client] : clients_) {
+        if (client->read_closed) {
+          continue;
+        }
+        fds.push_back({client->fd, POLLIN, 0});
+        polled.push_back(client);
+      }
+    }
+
+    if (poll(fds.data(), fds.size(), -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      logger::error("poll on control socket failed: {}", strerror(errno));
+      break;
+    }
+
+    if (fds[0].revents) {
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      accept_client();
+    }
+
+    for (size_t i = 0; i < polled.size(); ++i) {
+      if (!fds[i + 2].revents) {
+        continue;
+      }
+      if (!read_client(polled[i])) {
+        std::lock_guard lock(clients_mutex_);
+        if (polled[i]->subscribed) {
+          subscribers_--;
+        }
+        clients_.erase(polled[i]->id);
+      }
+    }
+  }
+}
+
+void ControlServer::accept_client() {
+  int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (fd == -1) {
+    return;
+  }
+
+  // Only the app itself, root and (on Android) the adb shell may drive the
+  // agent.
+  ucred cred{};
+  socklen_t cred_len = sizeof(cred);
+  bool allowed =
+      getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0 &&
+      (cred.uid == getuid() || cred.uid == 0
+#ifdef __ANDROID__
+       || cred.uid == 2000
+#endif
+      );
+  if (!allowed) {
+    logger::warn("Rejected control connection from uid {}", cred.uid);
+    close(fd);
+    return;
+  }
+
+  std::lock_guard lock(clients_mutex_);
+  if (clients_.size() >= kMaxClients) {
+    logger::warn("Too many control clients, rejecting connection");
+    close(fd);
+    return;
+  }
+  uint64_t id = next_client_id_++;
+  clients_.emplace(id, std::make_shared<Client>(id, fd));
+}
+
+// Returns false once the client should be disconnected.
+bool ControlServer::read_client(const std::shared_ptr<Client> &client) {
+  char buffer[64 * 1024];
+  // A client may send its commands and shut down its side straight away
+  // (e.g. piped through socat); what it sent is still carried out.
+  bool eof = false;
+  while (true) {
+    ssize_t n = read(client->fd, buffer, sizeof(buffer));
+    if (n > 0) {
+      client->inbuf.append(buffer, n);
+      continue;
+    }
+    if (n == 0) {
+      eof = true;
+      break;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    return false;
+  }
+
+  std::vector<Command> batch;
+  size_t pos = 0;
+  const std::string &in = client->inbuf;
+  while (in.size() - pos >= 5) {
+    uint32_t size = get_u32(in.data() + pos);
+    if (size == 0 || size > kMaxFrameSize) {
+      logger::warn("Control client sent a bad frame size {}", size);
+      return false;
+    }
+    if (in.size() - pos - 4 < size) {
+      break;
+    }
+
+    auto type = static_cast<CommandType>(in[pos + 4]);
+    std::string_view payload(in.data() + pos + 5, size - 1);
+    pos += 4 + size;
+
+    switch (type) {
+    case CommandType::LoadScript:
+    case CommandType::Unload:
+      batch.push_back({type, std::string(payload), {}});
+      break;
+    case CommandType::Post: {
+      uint32_t message_size =
+          payload.size() >= 4 ? get_u32(payload.data()) : UINT32_MAX;
+      if (message_size > payload.size() - 4) {
+        logger::warn("Control client sent a malformed Post frame");
+        return false;
+      }
+      batch.push_back({type, std::string(payload.substr(4, message_size)),
+                       std::string(payload.substr(4 + message_size))});
+      break;
+    }
+    case CommandType::Subscribe:
+    case CommandType::Unsubscribe: {
+      bool subscribe = type == CommandType::Subscribe;
+      std::lock_guard lock(clients_mutex_);
+      if (client->subscribed != subscribe) {
+        client->subscribed = subscribe;
+        subscribers_ += subscribe ? 1 : -1;
+      }
+      break;
+    }
+    case CommandType::Ping:
+      client->write_frame(make_frame(ReplyType::Pong, payload), false);
+      break;
+    case CommandType::Stats:
+      client->write_frame(
+          make_frame(ReplyType::Result,
+                     "\1" + probes::toJson(probes::snapshot())),
+          false);
+      break;
+    default:
+      logger::warn("Unknown control command {}", static_cast<int>(type));
+      return false;
+    }
+  }
+  client->inbuf.erase(0, pos);
+
+  if (eof) {
+    if (!client->inbuf.empty()) {
+      logger::warn("Control client closed in the middle of a frame");
+    }
+    if (batch.empty()) {
+      return false;
+    }
+    client->read_closed = true;
+  }
+  if (!batch.empty()) {
+    handler_(*this, client->id, std::move(batch));
+  }
+  return true;
+}
+
+void ControlServer::reply(uint64_t client_id,
+                          const std::vector<Result> &results) {
+  std::shared_ptr<Client> client;
+  {
+    std::lock_guard lock(clients_mutex_);
+    auto it = clients_.find(client_id);
+    if (it == clients_.end()) {
+      return;
+    }
+    client = it->second;
+  }
+
+  std::string frames;
+  for (const auto &result : results) {
+    std::string payload(1, result.ok ? '\1' : '\0');
+    payload.append(result.detail);
+    frames.append(make_frame(ReplyType::Result, payload));
+  }
+  client->write_frame(frames, false);
+
+  if (client->read_closed) {
+    std::lock_guard lock(clients_mutex_);
+    if (client->subscribed) {
+      subscribers_--;
+    }
+    clients_.erase(client_id);
+  }
+}
+
+void ControlServer::broadcast(std::string_view message, const void *data,
+                              size_t size) {
+  if (subscribers_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+
+  std::string payload;
+  payload.reserve(4 + message.size() + size);
+  put_u32(payload, static_cast<uint32_t>(message.size()));
+  payload.append(message);
+  if (size) {
+    payload.append(static_cast<const char *>(data), size);
+  }
+  std::string frame = make_frame(ReplyType::Message, payload);
+
+  std::vector<std::shared_ptr<Client>> subscribed;
+  {
+    std::lock_guard lock(clients_mutex_);
+    for (auto &[id, client] : clients_) {
+      if (client->subscribed) {
+        subscribed.push_back(client);
+      }
+    }
+  }
+  for (auto &client : subscribed) {
+    client->write_frame(frame, true);
+  }
+}
+#else
+struct ControlServer::Client {};
+
+ControlServer::ControlServer(int listen_fd, int wake_fd, BatchHandler handler)
+    : listen_fd_(listen_fd), wake_fd_(wake_fd), handler_(std::move(handler)) {}
+
+ControlServer::~ControlServer() = default;
+
+std::unique_ptr<ControlServer> ControlServer::start(std::string name,
+                                                    BatchHandler handler) {
+  logger::warn("Control socket is not supported on this platform");
+  return nullptr;
+}
+
+void ControlServer::stop() {}
+
+void ControlServer::reply(uint64_t client_id,
+                          const std::vector<Result> &results) {}
+
+void ControlServer::broadcast(std::string_view message, const void *data,
+                              size_t size) {}
+#endif
+
+} // namespace fripack::control
@@ -0,0 +1,114 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Local control channel on an abstract-namespace Unix stream socket.
+//
+// Every frame in either direction is
+//   u32 size (little-endian, bytes that follow) | u8 type | payload
+//
+// Client -> agent:
+//   LoadScript   payload = script source; replaces the running script
+//   Post         payload = u32 message_size | message | data blob;
+//                delivered with gum_script_post()
+//   Subscribe    stream script messages to this client
+//   Unsubscribe
+//   Ping         answered with Pong straight from the socket thread
+//   Stats        answered straight from the socket thread with a Result
+//                whose detail is the probe and hook statistics as JSON
+//   Unload       unloads the agent once the batch is answered; the
+//                connection is closed as part of it
+//
+// Agent -> client:
+//   Result       payload = u8 ok | detail text, one per
+//                LoadScript/Post/Stats/Unload
+//   Message      payload = u32 message_size | message | data blob
+//   Pong
+//
+// LoadScript, Post and Unload frames that arrive together are handed over
+// as one batch and applied in order in a single dispatch on the script's
+// thread. A client may shut down its sending side after its last frame;
+// that batch is still applied, and the connection closes once answered.
+namespace fripack::control {
+
+enum class CommandType : uint8_t {
+  LoadScript = 1,
+  Post = 2,
+  Subscribe = 3,
+  Unsubscribe = 4,
+  Ping = 5,
+  Stats = 6,
+  Unload = 7,
+};
+
+enum class ReplyType : uint8_t {
+  Result = 0x81,
+  Message = 0x82,
+  Pong = 0x83,
+};
+
+struct Command {
+  CommandType type;
+  std::string payload;
+  std::string data; // Post only.
+};
+
+struct Result {
+  bool ok;
+  std::string detail;
+};
+
+class ControlServer {
+public:
+  // Runs on the socket thread, possibly before start() has returned; reply
+  // through the server it is given.
+  using BatchHandler = std::function<void(
+      ControlServer &server, uint64_t client_id, std::vector<Command> batch)>;
+
+  ~ControlServer();
+
+  ControlServer(const ControlServer &) = delete;
+  ControlServer &operator=(const ControlServer &) = delete;
+
+  // Binds "\0<name>"; "{pid}" in name is replaced with the process id.
+  // Returns nullptr on failure or where abstract sockets do not exist.
+  static std::unique_ptr<ControlServer> start(std::string name,
+                                              BatchHandler handler);
+  void stop();
+
+  // Sends one Result frame per command of a batch, in order.
+  void reply(uint64_t client_id, const std::vector<Result> &results);
+  // Streams a script message to subscribed clients. Clients that cannot
+  // keep up miss messages rather than stalling the caller.
+  void broadcast(std::string_view message, const void *data, size_t size);
+
+private:
+  struct Client;
+
+  ControlServer(int listen_fd, int wake_fd, BatchHandler handler);
+
+  void run();
+  void accept_client();
+  bool read_client(const std::shared_ptr<Client> &client);
+
+  int listen_fd_;
+  int wake_fd_;
+  BatchHandler handler_;
+  std::thread thread_;
+  std::atomic<bool> should_stop_{false};
+  std::atomic<int> subscribers_{0};
+
+  std::mutex clients_mutex_;
+  std::map<uint64_t, std::shared_ptr<Client>> clients_;
+  uint64_t next_client_id_ = 1;
+};
+} // namespace fripack::control
@@ -0,0 +1,28 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+// Marks symbols the packer or a script looks up in the built library.
+#ifdef _WIN32
+#define EXPORT __declspec(dllexport)
+#else
+#define EXPORT __attribute__((visibility("default")))
+#endif
+
+namespace fripack {
+// For exports that return text: copies it into the caller's buffer,
+// truncated and NUL-terminated, and returns its full length like
+// snprintf(), so a caller can retry with a bigger buffer. The library keeps
+// no per-thread buffer, since pending thread_local destructors would stop
+// dlclose() from unmapping it.
+inline size_t copyOut(std::string_view text, char *buffer, size_t size) {
+  if (buffer && size != 0) {
+    size_t length = std::min(text.size(), size - 1);
+    std::memcpy(buffer, text.data(), length);
+    buffer[length] = '\0';
+  }
+  return text.size();
+}
+} // namespace fripack
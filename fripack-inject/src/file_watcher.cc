@@ -0,0 +1,159 @@
+#include "file_watcher.h"
+#include "logger.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fripack {
+
+namespace {
+// Quiet period after the last matching event before the change is reported.
+constexpr int kDebounceMs = 50;
+constexpr auto kPollInterval = std::chrono::milliseconds(500);
+} // namespace
+
+FileWatcher::FileWatcher(std::string path, Callback on_change)
+    : path_(std::move(path)), on_change_(std::move(on_change)) {}
+
+FileWatcher::~FileWatcher() { stop(); }
+
+void FileWatcher::start() {
+  should_stop_ = false;
+#ifdef __linux__
+  wake_fd_ = eventfd(0, EFD_CLOEXEC);
+#endif
+
+  thread_ = std::thread([this]() {
+    logger::println("[*] Started watching file: {}", path_);
+    if (!run_inotify()) {
+      run_polling();
+    }
+    logger::println("[*] File watcher stopped");
+  });
+}
+
+void FileWatcher::stop() {
+  should_stop_ = true;
+#ifdef __linux__
+  if (wake_fd_ != -1) {
+    uint64_t one = 1;
+    (void)!write(wake_fd_, &one, sizeof(one));
+  }
+#endif
+
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+#ifdef __linux__
+  if (wake_fd_ != -1) {
+    close(wake_fd_);
+    wake_fd_ = -1;
+  }
+#endif
+}
+
+#ifdef __linux__
+bool FileWatcher::run_inotify() {
+  if (wake_fd_ == -1) {
+    return false;
+  }
+
+  int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (fd == -1) {
+    logger::warn("inotify_init1 failed: {}, falling back to polling",
+                 strerror(errno));
+    return false;
+  }
+
+  // Watch the directory rather than the file so that editors and bundlers
+  // that save by writing a temp file and renaming it over the target are
+  // still seen after the original inode is gone.
+  std::filesystem::path path(path_);
+  auto dir = path.parent_path().empty() ? std::filesystem::path(".")
+                                        : path.parent_path();
+  auto name = path.filename().string();
+  if (inotify_add_watch(fd, dir.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY) ==
+      -1) {
+    logger::warn("inotify_add_watch({}) failed: {}, falling back to polling",
+                 dir.string(), strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  alignas(inotify_event) char buffer[4096];
+  bool pending = false;
+  while (!should_stop_) {
+    pollfd fds[2] = {{fd, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+    int ready = poll(fds, 2, pending ? kDebounceMs : -1);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      logger::error("poll on inotify failed: {}", strerror(errno));
+      break;
+    }
+
+    if (fds[1].revents) {
+      break;
+    }
+
+    if (ready == 0) {
+      pending = false;
+      on_change_();
+      continue;
+    }
+
+    ssize_t len;
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+      for (char *p = buffer; p < buffer + len;) {
+        auto *event = reinterpret_cast<inotify_event *>(p);
+        if (event->len && name == event->name) {
+          pending = true;
+        }
+        p += sizeof(inotify_event) + event->len;
+      }
+    }
+  }
+
+  close(fd);
+  return true;
+}
+#else
+bool FileWatcher::run_inotify() { return false; }
+#endif
+
+void FileWatcher::run_polling() {
+  std::filesystem::file_time_type last_write_time;
+  try {
+    last_write_time = std::filesystem::last_write_time(path_);
+  } catch (const std::exception &e) {
+    logger::error("Failed to get initial file time: {}", e.what());
+    return;
+  }
+
+  while (!should_stop_) {
+    try {
+      auto current_write_time = std::filesystem::last_write_time(path_);
+      if (current_write_time != last_write_time) {
+        last_write_time = current_write_time;
+        on_change_();
+      }
+    } catch (const std::exception &e) {
+      logger::error("Error watching file: {}", e.what());
+    }
+
+    std::this_thread::sleep_for(kPollInterval);
+  }
+}
+
+} // namespace fripack
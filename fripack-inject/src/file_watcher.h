@@ -0,0 +1,36 @@
+#pragma once
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace fripack {
+// Calls on_change from a background thread whenever the file at path is
+// rewritten. Uses inotify on Linux/Android, where bursts of writes and
+// atomic-rename saves collapse into one callback, and falls back to polling
+// the modification time elsewhere or when inotify is unavailable.
+class FileWatcher {
+public:
+  using Callback = std::function<void()>;
+
+  FileWatcher(std::string path, Callback on_change);
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  void start();
+  void stop();
+
+private:
+  bool run_inotify();
+  void run_polling();
+
+  std::string path_;
+  Callback on_change_;
+  std::thread thread_;
+  std::atomic<bool> should_stop_{false};
+  int wake_fd_ = -1;
+};
+} // namespace fripack
@@ -0,0 +1,269 @@
+#include "hook_profiler.h"
+#include "export.h"
+#include "logger.h"
+#include "probe_stats.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <string_view>
+
+#include "frida-gumjs.h"
+
+namespace fripack::profiler {
+namespace {
+// Callbacks may nest when a hooked function is called from another hook's
+// callback; deeper levels are counted but not timed.
+constexpr uint32_t kMaxDepth = 16;
+thread_local uint64_t t_starts[kMaxDepth];
+thread_local uint32_t t_depth = 0;
+
+constexpr std::string_view kBundleMagic = "📦\n";
+constexpr std::string_view kBundleSeparator = "✄\n";
+constexpr std::string_view kPreludeModule = "/_fripack_profile.js";
+
+// Kept on one line so the script's own line numbers do not move. The
+// timers are looked up by export name rather than address so the
+// instrumented source, and therefore its bytecode cache entry, stays the
+// same from run to run.
+std::string prelude() {
+  const char *module_name = "";
+  GumModule *module = gum_process_find_module_by_address(
+      GUM_ADDRESS(&fripack::profiler::instrumentScript));
+  if (module) {
+    module_name = gum_module_get_name(module);
+  }
+  std::string code = fmt::format(
+      "(() => {{"
+      "const m = Process.getModuleByName('{}');"
+      "const o = {{ scheduling: 'exclusive' }};"
+      "const reg = new NativeFunction(m.getExportByName("
+      "'fripack_js_hook_register'), 'uint32', ['pointer'], o);"
+      "const begin = new NativeFunction(m.getExportByName("
+      "'fripack_js_hook_begin'), 'void', [], o);"
+      "const end = new NativeFunction(m.getExportByName("
+      "'fripack_js_hook_end'), 'void', ['uint32'], o);"
+      "const attach = Interceptor.attach;"
+      "const wrap = (fn, name) => {{"
+      "const id = reg(Memory.allocUtf8String(name));"
+      "return function (...args) {{"
+      "begin(); try {{ return fn.apply(this, args); }} finally {{ end(id); }}"
+      "}};"
+      "}};"
+      "Interceptor.attach = function (target, callbacks, data) {{"
+      "const name = DebugSymbol.fromAddress(ptr(target)).toString();"
+      "let wrapped = callbacks;"
+      "if (typeof callbacks === 'function') {{"
+      "wrapped = wrap(callbacks, name);"
+      "}} else if (callbacks !== null && typeof callbacks === 'object' && "
+      "!(callbacks instanceof NativePointer)) {{"
+      "wrapped = Object.assign({{}}, callbacks);"
+      "if (typeof callbacks.onEnter === 'function') "
+      "wrapped.onEnter = wrap(callbacks.onEnter, name + ' onEnter');"
+      "if (typeof callbacks.onLeave === 'function') "
+      "wrapped.onLeave = wrap(callbacks.onLeave, name + ' onLeave');"
+      "}}"
+      "return attach.call(Interceptor, target, wrapped, data);"
+      "}};"
+      "}})();",
+      module_name);
+  if (module) {
+    g_object_unref(module);
+  }
+  return code;
+}
+
+// A frida-compile bundle is
+//   📦\n <size> <path>\n ... ✄\n <asset>\n✄\n <asset> ...
+// with the entry point first. The prelude becomes a module of its own that
+// the entry point imports before anything else, since imports are
+// evaluated before the importing module's body.
+std::string instrument_bundle(const std::string &source) {
+  size_t header_end = source.find(kBundleSeparator, kBundleMagic.size());
+  if (header_end == std::string::npos) {
+    return {};
+  }
+  std::string_view header = std::string_view(source).substr(
+      kBundleMagic.size(), header_end - kBundleMagic.size());
+  std::string_view assets =
+      std::string_view(source).substr(header_end + kBundleSeparator.size());
+
+  // Assets are separated by "\n✄\n"; anything after the last one (such as
+  // a trailing newline) would break the separator added below.
+  uint64_t assets_size = 0;
+  size_t asset_count = 0;
+  for (size_t pos = 0; pos < header.size();) {
+    size_t end = header.find('\n', pos);
+    if (end == std::string_view::npos) {
+      return {};
+    }
+    assets_size += std::strtoull(
+        std::string(header.substr(pos, end - pos)).c_str(), nullptr, 10);
+    ++asset_count;
+    pos = end + 1;
+  }
+  if (asset_count == 0) {
+    return {};
+  }
+  assets_size += (asset_count - 1) * (1 + kBundleSeparator.size());
+  if (assets_size > assets.size()) {
+    return {};
+  }
+  assets = assets.substr(0, assets_size);
+
+  size_t first_line_end = header.find('\n');
+  size_t space = header.find(' ');
+  if (space > first_line_end) {
+    return {};
+  }
+  std::string_view entry_path =
+      header.substr(space + 1, first_line_end - space - 1);
+  uint64_t entry_size =
+      std::strtoull(std::string(header.substr(0, space)).c_str(), nullptr, 10);
+
+  std::string import_line = fmt::format("import \"{}\";", kPreludeModule);
+  std::string module = prelude();
+
+  std::string out(kBundleMagic);
+  out += fmt::format("{} {}\n", entry_size + import_line.size(), entry_path);
+  out += header.substr(first_line_end + 1);
+  out += fmt::format("{} {}\n", module.size(), kPreludeModule);
+  out += kBundleSeparator;
+  out += import_line;
+  out += assets;
+  out += "\n";
+  out += kBundleSeparator;
+  out += module;
+  return out;
+}
+// Offset in a plain script after which the prelude can go: past a leading
+// `#!` line and the directive prologue ('use strict' and the like), which
+// must stay first to keep their meaning. `needs_semicolon` is set when the
+// last directive relies on automatic semicolon insertion.
+size_t prologue_end(std::string_view source, bool &needs_semicolon) {
+  size_t pos = 0;
+  needs_semicolon = false;
+  if (source.starts_with("#!")) {
+    pos = source.find('\n');
+    if (pos == std::string_view::npos) {
+      return source.size();
+    }
+    ++pos;
+  }
+  // Skips whitespace and comments; returns false on an unterminated comment.
+  auto skip = [&](size_t &at, bool &crossed_line) {
+    crossed_line = false;
+    while (at < source.size()) {
+      char c = source[at];
+      if (c == '\n' || c == '\r') {
+        crossed_line = true;
+        ++at;
+      } else if (c == ' ' || c == '\t' || c == '\v' || c == '\f') {
+        ++at;
+      } else if (source.substr(at).starts_with("//")) {
+        at = source.find('\n', at);
+        if (at == std::string_view::npos) {
+          at = source.size();
+        }
+      } else if (source.substr(at).starts_with("/*")) {
+        size_t close = source.find("*/", at + 2);
+        if (close == std::string_view::npos) {
+          return false;
+        }
+        if (source.substr(at, close - at).find('\n') !=
+            std::string_view::npos) {
+          crossed_line = true;
+        }
+        at = close + 2;
+      } else {
+        break;
+      }
+    }
+    return true;
+  };
+
+  size_t end = pos;
+  size_t at = pos;
+  bool crossed_line;
+  while (skip(at, crossed_line) && at < source.size() &&
+         (source[at] == '\'' || source[at] == '"')) {
+    char quote = source[at];
+    size_t close = at + 1;
+    while (close < source.size() && source[close] != quote &&
+           source[close] != '\n') {
+      close += source[close] == '\\' ? 2 : 1;
+    }
+    if (close >= source.size() || source[close] != quote) {
+      break;
+    }
+    size_t next = close + 1;
+    if (!skip(next, crossed_line)) {
+      break;
+    }
+    if (next < source.size() && source[next] == ';') {
+      end = next + 1;
+      needs_semicolon = false;
+    } else if (next == source.size() || source[next] == '}' ||
+               (crossed_line && (std::isalnum(static_cast<unsigned char>(
+                                     source[next])) ||
+                                 source[next] == '_' || source[next] == '$' ||
+                                 source[next] == '\'' ||
+                                 source[next] == '"' || source[next] == '{'))) {
+      // Ended by automatic semicolon insertion.
+      end = close + 1;
+      needs_semicolon = true;
+    } else {
+      // The string is part of a longer expression, not a directive.
+      break;
+    }
+    at = end;
+  }
+  return end;
+}
+} // namespace
+
+std::string instrumentScript(const std::string &source) {
+  if (source.starts_with(kBundleMagic)) {
+    std::string instrumented = instrument_bundle(source);
+    if (instrumented.empty()) {
+      logger::warn("Unrecognized script bundle, not profiling its hooks");
+      return source;
+    }
+    return instrumented;
+  }
+  bool needs_semicolon;
+  size_t at = prologue_end(source, needs_semicolon);
+  std::string out = source.substr(0, at);
+  if (needs_semicolon) {
+    out += ";";
+  }
+  out += prelude();
+  out += std::string_view(source).substr(at);
+  return out;
+}
+} // namespace fripack::profiler
+
+extern "C" {
+EXPORT uint32_t fripack_js_hook_register(const char *name) {
+  return fripack::probes::registerTarget(std::string("js:") + name);
+}
+
+EXPORT void fripack_js_hook_begin() {
+  using namespace fripack::profiler;
+  if (t_depth < kMaxDepth) {
+    t_starts[t_depth] = fripack::probes::nowNs();
+  }
+  ++t_depth;
+}
+
+EXPORT void fripack_js_hook_end(uint32_t id) {
+  using namespace fripack::profiler;
+  if (t_depth == 0) {
+    return;
+  }
+  --t_depth;
+  fripack::probes::record(id, t_depth < kMaxDepth
+                                  ? fripack::probes::nowNs() - t_starts[t_depth]
+                                  : 0);
+}
+}
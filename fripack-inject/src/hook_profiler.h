@@ -0,0 +1,12 @@
+#pragma once
+#include <string>
+
+namespace fripack::profiler {
+// Returns source with a prelude that wraps every Interceptor.attach()
+// callback the script installs with native begin/end timers. Calls are
+// counted per target and callback under "js:<symbol> onEnter" etc. in the
+// probe statistics. Handles plain scripts, where the prelude goes after any
+// `#!` line and directive prologue, and frida-compile bundles. Needs Gum to
+// be initialized.
+std::string instrumentScript(const std::string &source);
+} // namespace fripack::profiler
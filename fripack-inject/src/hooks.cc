@@ -4,104 +4,230 @@
 #include <frida-gumjs.h>
 
 #if defined(__ANDROID__) && (defined(__aarch64__) || defined(__arm__))
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <link.h>
+#include <map>
+#include <mutex>
 #include <shadowhook.h>
 #include <stdio.h>
+#include <string_view>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 namespace fripack::hooks {
-void init() {
+namespace {
+// Same layout as GLib's private struct _GMappedFile, so the GLib accessors
+// and g_mapped_file_ref() work on our objects unchanged.
+struct SharedMappedFile {
+  gchar *contents;
+  gsize length;
+  gpointer free_func;
+  std::atomic<gint> ref_count;
+};
+
+constexpr size_t kMaxSharedFiles = 32;
+constexpr size_t kReadChunk = 1024 * 1024;
+
+// Guards g_prefixes and g_files. configure() may run after the hooks are
+// installed, since the config is decoded while Gum starts up.
+std::mutex g_files_mutex;
+std::vector<std::string> g_prefixes = {"/apex/com.android.runtime/bin/linker"};
+std::map<std::string, SharedMappedFile *, std::less<>> g_files;
+// Checked without the lock by the g_mapped_file_unref() hook.
+std::array<std::atomic<SharedMappedFile *>, kMaxSharedFiles> g_owned{};
+std::atomic<size_t> g_owned_count{0};
+
+void *orig_g_mapped_file_new;
+void *orig_g_mapped_file_unref;
+void *g_new_stub;
+void *g_unref_stub;
+
+bool is_shared(GMappedFile *file) {
+  size_t count = g_owned_count.load(std::memory_order_acquire);
+  for (size_t i = 0; i < count; ++i) {
+    if (g_owned[i].load(std::memory_order_relaxed) ==
+        reinterpret_cast<SharedMappedFile *>(file)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void set_errno_error(GError **error, const char *what, int err) {
+  if (error) {
+    *error = g_error_new(G_FILE_ERROR, g_file_error_from_errno(err),
+                         "%s: %s", what, g_strerror(err));
+  }
+}
+
+// Reads the whole file into a private anonymous mapping, then makes it
+// read-only since every caller shares it.
+SharedMappedFile *load_file(const char *filename, GError **error) {
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    int err = errno;
+    logger::error("Failed to open {}: {}", filename, g_strerror(err));
+    set_errno_error(error, "Failed to open file", err);
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    int err = errno;
+    close(fd);
+    set_errno_error(error, "Failed to stat file", err);
+    return nullptr;
+  }
 
+  size_t size = st.st_size;
+  void *contents = nullptr;
+  if (size != 0) {
+    contents = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (contents == MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      set_errno_error(error, "Failed to allocate buffer", err);
+      return nullptr;
+    }
+  }
+
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = read(fd, static_cast<char *>(contents) + done,
+                     std::min(kReadChunk, size - done));
+    if (n > 0) {
+      done += n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else {
+      int err = n == 0 ? EIO : errno;
+      logger::error("Short read of {}: {} of {} bytes", filename, done, size);
+      close(fd);
+      munmap(contents, size);
+      set_errno_error(error, "Failed to read file", err);
+      return nullptr;
+    }
+  }
+  close(fd);
+  if (contents) {
+    mprotect(contents, size, PROT_READ);
+  }
+
+  auto *file = new SharedMappedFile{static_cast<gchar *>(contents), size,
+                                    nullptr, 1};
+  logger::debug("[Shadowhook] Cached {} ({} bytes)", filename, size);
+  return file;
+}
+
+GMappedFile *mapped_file_new(const gchar *filename, gboolean writable,
+                             GError **error) {
+  auto orig = reinterpret_cast<decltype(&g_mapped_file_new)>(
+      orig_g_mapped_file_new);
+  if (!filename || writable) {
+    return orig(filename, writable, error);
+  }
+  std::string_view name(filename);
+  std::unique_lock lock(g_files_mutex);
+  bool matches = false;
+  for (const auto &prefix : g_prefixes) {
+    matches = matches || name.starts_with(prefix);
+  }
+  if (!matches) {
+    lock.unlock();
+    return orig(filename, writable, error);
+  }
+
+  auto it = g_files.find(name);
+  if (it == g_files.end()) {
+    size_t slot = g_owned_count.load(std::memory_order_relaxed);
+    if (slot == kMaxSharedFiles) {
+      lock.unlock();
+      return orig(filename, writable, error);
+    }
+    // The cache keeps its own reference, so a shared file is never freed.
+    SharedMappedFile *file = load_file(filename, error);
+    if (!file) {
+      return nullptr;
+    }
+    g_owned[slot].store(file, std::memory_order_relaxed);
+    g_owned_count.store(slot + 1, std::memory_order_release);
+    it = g_files.emplace(std::string(name), file).first;
+  }
+  it->second->ref_count.fetch_add(1, std::memory_order_relaxed);
+  return reinterpret_cast<GMappedFile *>(it->second);
+}
+
+void mapped_file_unref(GMappedFile *file) {
+  if (is_shared(file)) {
+    reinterpret_cast<SharedMappedFile *>(file)->ref_count.fetch_sub(
+        1, std::memory_order_relaxed);
+    return;
+  }
+  reinterpret_cast<decltype(&g_mapped_file_unref)>(orig_g_mapped_file_unref)(
+      file);
+}
+} // namespace
+
+void configure(std::vector<std::string> mapped_file_prefixes) {
+  std::lock_guard lock(g_files_mutex);
+  g_prefixes = std::move(mapped_file_prefixes);
+}
+
+void init() {
   if (auto errn = shadowhook_init(SHADOWHOOK_MODE_SHARED, false)) {
-    logger::println("Shadowhook init failed: {}", shadowhook_to_errmsg(errn));
+    logger::error("Shadowhook init failed: {}", shadowhook_to_errmsg(errn));
     return;
   }
 
-  static void *orig_g_mapped_file_new;
-  shadowhook_hook_func_addr(
+  // Unref first, so no shared file can reach the real one.
+  g_unref_stub = shadowhook_hook_func_addr(
+      reinterpret_cast<void *>(&g_mapped_file_unref),
+      reinterpret_cast<void *>(&mapped_file_unref), &orig_g_mapped_file_unref);
+  g_new_stub = shadowhook_hook_func_addr(
       reinterpret_cast<void *>(&g_mapped_file_new),
-      reinterpret_cast<void *>(+[](const gchar *filename, gboolean writable,
-                                   GError **error) -> GMappedFile * {
-        std::string fname = filename ? filename : "(null)";
-        if (fname.starts_with("/apex/com.android.runtime/bin/linker")) {
-          logger::println("[Shadowhook] g_mapped_file_new called:\n");
-          logger::println("  filename: {}", filename ? filename : "(null)");
-          logger::println("  writable: {}", writable ? "true" : "false");
-
-          typedef struct {
-            gchar *content;
-            gsize length;
-            gboolean writable;
-            gint ref_count;
-            gboolean is_custom_buffer;
-          } CustomMappedFile;
-          
-          logger::println("  [INTERCEPT] Replacing mmap with traditional read");
-
-          int fd = open(filename, writable ? O_RDWR : O_RDONLY);
-          if (fd == -1) {
-            logger::println("  [ERROR] Failed to open file: {}",
-                            filename ? filename : "(null)");
-            if (error) {
-              *error =
-                  g_error_new(G_FILE_ERROR, g_file_error_from_errno(errno),
-                              "Failed to open file: %s", g_strerror(errno));
-            }
-            return nullptr;
-          }
-
-          struct stat st;
-          if (fstat(fd, &st) == -1) {
-            logger::println("  [ERROR] Failed to stat file");
-            close(fd);
-            return nullptr;
-          }
-
-          gsize file_size = st.st_size;
-          logger::println("  file_size: {}", file_size);
-
-          gchar *buffer = static_cast<gchar *>(g_malloc(file_size));
-          if (!buffer) {
-            logger::println("  [ERROR] Failed to allocate buffer");
-            close(fd);
-            return nullptr;
-          }
-
-          ssize_t bytes_read = read(fd, buffer, file_size);
-          close(fd);
-
-          if (bytes_read != static_cast<ssize_t>(file_size)) {
-            printf("  [ERROR] Failed to read complete file\n");
-            g_free(buffer);
-            return nullptr;
-          }
-
-          CustomMappedFile *custom_file = g_new0(CustomMappedFile, 1);
-          custom_file->content = buffer;
-          custom_file->length = file_size;
-          custom_file->writable = writable;
-          custom_file->ref_count = 1;
-          custom_file->is_custom_buffer = true;
-
-          logger::println("  [SUCCESS] Created custom buffer: {}, size: {}",
-                          custom_file->content, custom_file->length);
-
-          return reinterpret_cast<GMappedFile *>(custom_file);
-        } else {
-          return (decltype (&g_mapped_file_new)(orig_g_mapped_file_new))(
-              filename, writable, error);
-        }
-      }),
-      &orig_g_mapped_file_new);
+      reinterpret_cast<void *>(&mapped_file_new), &orig_g_mapped_file_new);
+}
+
+void deinit() {
+  // The reverse of init(): once new is unhooked no shared file is handed
+  // out, and once unref is too none may still be in use.
+  if (g_new_stub) {
+    shadowhook_unhook(g_new_stub);
+    g_new_stub = nullptr;
+  }
+  if (g_unref_stub) {
+    shadowhook_unhook(g_unref_stub);
+    g_unref_stub = nullptr;
+  }
+
+  std::lock_guard lock(g_files_mutex);
+  size_t count = g_owned_count.exchange(0, std::memory_order_acq_rel);
+  for (size_t i = 0; i < count; ++i) {
+    SharedMappedFile *file = g_owned[i].exchange(nullptr);
+    if (file->ref_count.load(std::memory_order_relaxed) != 1) {
+      logger::warn("[Shadowhook] Shared file still in use, leaking it");
+      continue;
+    }
+    if (file->contents) {
+      munmap(file->contents, file->length);
+    }
+    delete file;
+  }
+  g_files.clear();
 }
 
 } // namespace fripack::hooks
 #else
 namespace fripack::hooks {
+void configure(std::vector<std::string>) {}
 void init() {}
+void deinit() {}
 } // namespace fripack::hooks
-#endif
\ No newline at end of file
+#endif
@@ -1,5 +1,15 @@
 #pragma once
+#include <string>
+#include <vector>
 
 namespace fripack::hooks {
+// Files whose path starts with one of these are read once into a private
+// anonymous copy when Gum maps them, and every later g_mapped_file_new() of
+// the same path shares that copy. May be called before or after init();
+// defaults to the Android runtime linker.
+void configure(std::vector<std::string> mapped_file_prefixes);
 void init();
-}
\ No newline at end of file
+// Removes the hooks and frees the shared copies. Call after
+// gum_deinit_embedded(), which releases Gum's references to them.
+void deinit();
+}
@@ -0,0 +1,162 @@
+#include "logger.h"
+#include "bounded_queue.h"
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+namespace fripack::logger {
+
+namespace {
+constexpr const char *kTag = "FriPackInject";
+constexpr size_t kQueueCapacity = 2048;
+
+struct Entry {
+  Level level = Level::Info;
+  std::chrono::system_clock::time_point time;
+  std::string message;
+};
+
+// Never freed: threads may still log, and the writer may still be popping,
+// while static destructors run at exit().
+BoundedQueue<Entry, kQueueCapacity> &queue() {
+  static auto *queue = new BoundedQueue<Entry, kQueueCapacity>();
+  return *queue;
+}
+std::atomic<uint64_t> g_dropped{0};
+std::atomic<uint64_t> g_enqueued{0};
+std::atomic<uint64_t> g_written{0};
+std::atomic<uint64_t> g_written_bytes{0};
+// True while the writer is parked waiting for work; producers clear it and
+// notify, so an idle process has no periodic wakeups.
+std::atomic<bool> g_writer_sleeping{false};
+std::atomic<bool> g_writer_stop{false};
+std::once_flag g_writer_started;
+// A pointer, so no destructor finds it joinable at exit().
+std::thread *g_writer = nullptr;
+
+#ifdef __ANDROID__
+void write(const Entry &entry) {
+  static constexpr int priorities[] = {ANDROID_LOG_DEBUG, ANDROID_LOG_INFO,
+                                       ANDROID_LOG_WARN, ANDROID_LOG_ERROR};
+  __android_log_write(priorities[static_cast<int>(entry.level)], kTag,
+                      entry.message.c_str());
+}
+#else
+void write(const Entry &entry) {
+  static constexpr const char *level_names[] = {"D", "I", "W", "E"};
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                entry.time.time_since_epoch()) %
+            1000;
+
+  std::string formatted = fmt::format(
+      "[{:%Y-%m-%d %H:%M:%S}.{:03d}] [{}] [{}] {}", entry.time, ms.count(),
+      kTag, level_names[static_cast<int>(entry.level)], entry.message);
+
+  fmt::println("{}", formatted);
+
+#ifdef _WIN32
+  OutputDebugStringA(formatted.c_str());
+  OutputDebugStringA("\n");
+#endif
+}
+#endif
+
+void writer_main() {
+  uint64_t reported_dropped = 0;
+  while (true) {
+    while (auto entry = queue().try_pop()) {
+      write(*entry);
+      g_written_bytes.fetch_add(entry->message.size(),
+                                std::memory_order_relaxed);
+      g_written.fetch_add(1, std::memory_order_release);
+      g_written.notify_all();
+    }
+
+    uint64_t dropped = g_dropped.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped) {
+      write({Level::Warn, std::chrono::system_clock::now(),
+             fmt::format("Log queue full, dropped {} messages",
+                         dropped - reported_dropped)});
+      reported_dropped = dropped;
+    }
+
+    if (g_writer_stop.load()) {
+      return;
+    }
+    g_writer_sleeping.store(true);
+    if (!queue().empty() || g_writer_stop.load()) {
+      g_writer_sleeping.store(false);
+      continue;
+    }
+    g_writer_sleeping.wait(true);
+  }
+}
+} // namespace
+
+void enqueue(Level level, std::string message) {
+  std::call_once(g_writer_started, []() {
+    g_writer = new std::thread(writer_main);
+#ifndef _WIN32
+    // Registered on the first message, so at exit() this runs before the
+    // destructors of anything constructed earlier, and what is queued is
+    // written out. On dlclose() the library destructor has already shut
+    // the writer down and this does nothing. Not on Windows, where the
+    // handler would join under the loader lock.
+    std::atexit(shutdown);
+#endif
+  });
+
+  if (g_writer_stop.load(std::memory_order_relaxed)) {
+    g_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  if (!queue().try_push({level, std::chrono::system_clock::now(),
+                         std::move(message)})) {
+    g_dropped.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    g_enqueued.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  if (g_writer_sleeping.exchange(false)) {
+    g_writer_sleeping.notify_one();
+  }
+}
+
+void flush() {
+  uint64_t target = g_enqueued.load(std::memory_order_relaxed);
+  uint64_t written;
+  while ((written = g_written.load(std::memory_order_acquire)) < target) {
+    g_written.wait(written);
+  }
+}
+
+void shutdown() {
+  std::call_once(g_writer_started, []() {});
+  if (!g_writer) {
+    return;
+  }
+  g_writer_stop.store(true);
+  g_writer_sleeping.store(false);
+  g_writer_sleeping.notify_one();
+  g_writer->join();
+  delete g_writer;
+  g_writer = nullptr;
+}
+
+uint64_t dropped_count() { return g_dropped.load(std::memory_order_relaxed); }
+
+uint64_t written_bytes() {
+  return g_written_bytes.load(std::memory_order_relaxed);
+}
+
+} // namespace fripack::logger
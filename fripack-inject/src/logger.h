@@ -1,44 +1,65 @@
-#ifdef __ANDROID__
-#include <android/log.h>
-#include <jni.h>
-#elif defined(_WIN32)
-#include <windows.h>
-#endif
-
+#pragma once
 #include <string>
 #include <fmt/chrono.h>
 #include <fmt/format.h>
 
+// Messages below this level are compiled out. 0 = debug, 1 = info,
+// 2 = warn, 3 = error. Release builds default to info.
+#ifndef FRIPACK_LOG_MIN_LEVEL
+#define FRIPACK_LOG_MIN_LEVEL 0
+#endif
+
 namespace fripack::logger {
 
-#ifdef __ANDROID__
-inline void log(const char *tag, const std::string &message) {
-  __android_log_write(ANDROID_LOG_INFO, tag, message.c_str());
-}
+enum class Level : int {
+  Debug = 0,
+  Info = 1,
+  Warn = 2,
+  Error = 3,
+};
 
-#else
-inline void log(const char *tag, const std::string &message) {
-  auto now = std::chrono::system_clock::now();
-  auto time_t = std::chrono::system_clock::to_time_t(now);
-  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                now.time_since_epoch()) %
-            1000;
+inline constexpr Level kMinLevel = static_cast<Level>(FRIPACK_LOG_MIN_LEVEL);
 
-  std::string formatted = fmt::format("[{:%Y-%m-%d %H:%M:%S}.{:03d}] [{}] {}",
-                                      now, ms.count(), tag, message);
+// Hands the message to the background writer without locking or doing I/O
+// on the calling thread. If the queue is full the message is dropped and
+// counted.
+void enqueue(Level level, std::string message);
 
-  fmt::println("{}", formatted);
+// Blocks until everything queued so far has been written.
+void flush();
 
-#ifdef _WIN32
-  OutputDebugStringA(formatted.c_str());
-  OutputDebugStringA("\n");
-#endif
+// Writes what is queued and joins the writer. Messages logged afterwards
+// are dropped. Also runs at exit(), except on Windows.
+void shutdown();
+
+uint64_t dropped_count();
+// Bytes of message text written so far.
+uint64_t written_bytes();
+
+template <Level L, typename... Args>
+void log(fmt::format_string<Args...> format, Args &&...args) {
+  if constexpr (L >= kMinLevel) {
+    enqueue(L, fmt::format(format, std::forward<Args>(args)...));
+  }
+}
+
+template <typename... Args>
+void debug(fmt::format_string<Args...> format, Args &&...args) {
+  log<Level::Debug>(format, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void warn(fmt::format_string<Args...> format, Args &&...args) {
+  log<Level::Warn>(format, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void error(fmt::format_string<Args...> format, Args &&...args) {
+  log<Level::Error>(format, std::forward<Args>(args)...);
 }
-#endif
 
 template <typename... Args>
 void println(fmt::format_string<Args...> format, Args &&...args) {
-  std::string message = fmt::format(format, std::forward<Args>(args)...);
-  log("FriPackInject", message);
+  log<Level::Info>(format, std::forward<Args>(args)...);
 }
-} // namespace fripack::logger
\ No newline at end of file
+} // namespace fripack::logger
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
@@ -10,6 +12,8 @@
 #include <vector>
 #include <filesystem>
 #include <atomic>
+#include <optional>
+#include <string_view>
 
 #include "logger.h"
 
@@ -26,24 +30,80 @@
 #include "hooks.h"
 #include "stacktrace.h"
 #include "config.h"
+#include "control_socket.h"
+#include "export.h"
+#include "file_watcher.h"
+#include "hook_profiler.h"
+#include "message.h"
+#include "message_drain.h"
+#include "metrics.h"
+#include "patch_window.h"
+#include "probe_stats.h"
+#include "probes.h"
+#include "script_cache.h"
+#include "script_selector.h"
+#include "stack_table.h"
+#include "startup.h"
+#include "symbol_index.h"
+#include "trace.h"
 
 namespace fripack {
 
+void request_unload();
+
 class GumJSHookManager {
+public:
+  struct ScriptSource {
+    std::string name;
+    std::string content;
+    std::optional<std::string> bytecode;
+    config::Runtime runtime = config::Runtime::QuickJs;
+  };
+
 private:
+  struct LoadedScript {
+    std::string name;
+    GumScript *script;
+    // Reloads compile on the same engine.
+    GumScriptBackend *backend;
+  };
+
   std::unique_ptr<std::thread> hook_thread_;
-  std::unique_ptr<std::thread> watch_thread_;
 
+  // QuickJS; V8 is obtained the first time a script asks for it.
   GumScriptBackend *backend_ = nullptr;
+  GumScriptBackend *v8_backend_ = nullptr;
+  bool v8_checked_ = false;
   GCancellable *cancellable_ = nullptr;
   GError *error_ = nullptr;
-  GumScript *script_ = nullptr;
-  GMainContext *context_ = nullptr;
+  // In load order. Reloads and control commands address the first one.
+  std::vector<LoadedScript> scripts_;
+  std::atomic<GMainContext *> context_{nullptr};
   GMainLoop *loop_ = nullptr;
   bool initialized_ = false;
-  std::atomic<bool> should_stop_watching_{false};
-  std::string watch_path_;
-  std::filesystem::file_time_type last_write_time_;
+  // Set on the JS thread; read by cleanup() once that thread is joined.
+  bool gum_initialized_ = false;
+  // Seen by the JS thread before it enters its loop, so a stop() that
+  // races with startup does not leave the loop running.
+  std::atomic<bool> stopping_{false};
+  std::optional<uint32_t> unload_after_ms_;
+  std::unique_ptr<FileWatcher> watcher_;
+  std::unique_ptr<ScriptCache> script_cache_;
+  std::unique_ptr<trace::TraceRecorder> trace_;
+  std::unique_ptr<control::ControlServer> control_;
+  std::unique_ptr<metrics::MetricsPublisher> metrics_;
+  // Declared after the sinks it feeds, so it stops before they go away.
+  std::unique_ptr<message::Drain> drain_;
+  std::optional<std::string> startup_report_path_;
+  bool post_startup_phases_ = false;
+  std::optional<config::ProbesConfig> probes_;
+  std::optional<config::HookProfileConfig> profile_hooks_;
+  // The initial load, until every script has loaded. Owned by whichever
+  // thread is waiting for it: the constructor, then the JS thread.
+  GMainContext *load_context_ = nullptr;
+  size_t loads_pending_ = 0;
+  std::unique_ptr<patching::Window> load_window_;
+  std::unique_ptr<patching::Transaction> load_transaction_;
 
 public:
   GumJSHookManager() = default;
@@ -52,11 +112,55 @@ public:
   GumJSHookManager(const GumJSHookManager &) = delete;
   GumJSHookManager &operator=(const GumJSHookManager &) = delete;
 
+  static void log_console(std::string_view level, std::string_view text) {
+    if (level == "error") {
+      logger::error("[*] log: {}", text);
+    } else if (level == "warning") {
+      logger::warn("[*] log: {}", text);
+    } else if (level == "debug") {
+      logger::debug("[*] log: {}", text);
+    } else {
+      logger::println("[*] log: {}", text);
+    }
+  }
+
+  // Runs on the script's thread, so it only queues the message.
   static void on_message(const gchar *message, GBytes *data,
                          gpointer user_data) {
+    auto *self = static_cast<GumJSHookManager *>(user_data);
+    if (self->drain_) {
+      self->drain_->push(message, data);
+    } else {
+      self->handle_message(message, data);
+    }
+  }
+
+  // Feeds a script message to the trace, the control socket and the log.
+  void handle_message(std::string_view message, GBytes *data) {
+    gsize data_size = 0;
+    const void *data_bytes =
+        data ? g_bytes_get_data(data, &data_size) : nullptr;
+    if (trace_) {
+      trace_->append(message, data_bytes, data_size);
+    }
+    if (control_) {
+      control_->broadcast(message, data_bytes, data_size);
+    }
+
+    message::Message parsed;
+    if (message::classify(message, parsed)) {
+      if (parsed.type == message::Type::Log) {
+        log_console(parsed.level, parsed.text);
+      } else {
+        logger::println("[*] {}", message);
+      }
+      return;
+    }
+
     JsonParser *parser = json_parser_new();
-    if (!json_parser_load_from_data(parser, message, -1, nullptr)) {
-      logger::println("Failed to parse JSON message");
+    if (!json_parser_load_from_data(parser, message.data(), message.size(),
+                                    nullptr)) {
+      logger::error("Failed to parse JSON message");
       g_object_unref(parser);
       return;
     }
@@ -77,7 +181,9 @@ public:
     if (type && strcmp(type, "log") == 0) {
       const gchar *log_message = json_object_get_string_member(root, "payload");
       if (log_message) {
-        logger::println("[*] log: {}", log_message);
+        log_console(
+            json_object_get_string_member_with_default(root, "level", "info"),
+            log_message);
       }
     } else {
       logger::println("[*] {}", message);
@@ -86,48 +192,219 @@ public:
     g_object_unref(parser);
   }
 
-  std::promise<void> start_js_thread(const std::string &js_content) {
-    logger::println("[*] Starting GumJS hook thread");
-    std::promise<void> init_promise;
-    std::future<void> init_future = init_promise.get_future();
-    std::thread([this, js_content = std::move(js_content),
-                 promise = std::move(init_promise)]() mutable {
-      gum_init_embedded();
+  GumScript *create_script_from_bytecode(const std::string &js_bytecode) {
+    gsize bytecode_size = 0;
+    guchar *bytecode = g_base64_decode(js_bytecode.c_str(), &bytecode_size);
+    GBytes *bytes = g_bytes_new_take(bytecode, bytecode_size);
+
+    GumScript *script = gum_script_backend_create_from_bytes_sync(
+        backend_, bytes, nullptr, cancellable_, &error_);
+    g_bytes_unref(bytes);
+
+    if (error_) {
+      logger::error("Failed to create script from bytecode: {}",
+                    error_->message);
+      g_clear_error(&error_);
+      return nullptr;
+    }
+
+    logger::println("[*] Created Gum Script from {} bytes of bytecode",
+                    bytecode_size);
+    return script;
+  }
+
+  void set_trace_recorder(std::unique_ptr<trace::TraceRecorder> trace) {
+    trace_ = std::move(trace);
+  }
+
+  void set_metrics(std::unique_ptr<metrics::MetricsPublisher> metrics) {
+    metrics_ = std::move(metrics);
+  }
 
-      backend_ = gum_script_backend_obtain_qjs();
-      logger::println("[*] Obtained Gum Script Backend");
+  void set_message_backpressure(config::Backpressure policy) {
+    drain_ = std::make_unique<message::Drain>(
+        policy, [this](std::string_view message, GBytes *data) {
+          handle_message(message, data);
+        });
+  }
 
-      fripack::hooks::init();
+  void set_script_cache(std::unique_ptr<ScriptCache> script_cache) {
+    script_cache_ = std::move(script_cache);
+  }
 
-      script_ =
-          gum_script_backend_create_sync(backend_, "script", js_content.data(),
-                                         nullptr, cancellable_, &error_);
-      logger::println("[*] Created Gum Script");
+  // QuickJS unless V8 is asked for and linked in. JS thread only.
+  GumScriptBackend *backend_for(config::Runtime runtime) {
+    if (runtime != config::Runtime::V8) {
+      return backend_;
+    }
+    if (!v8_checked_) {
+      v8_checked_ = true;
+      v8_backend_ = gum_script_backend_obtain_v8();
+      if (v8_backend_) {
+        logger::println("[*] Obtained V8 Gum Script Backend");
+      } else {
+        logger::warn("V8 runtime not available in this build, falling back "
+                     "to QuickJS");
+      }
+    }
+    return v8_backend_ ? v8_backend_ : backend_;
+  }
 
-      if (error_) {
-        throw std::runtime_error(
-            fmt::format("Failed to create script: {}", error_->message));
+  // Compiles source, going through the bytecode cache when one is set and
+  // the backend is QuickJS. On failure returns nullptr with error_ set,
+  // like gum_script_backend_create_sync.
+  GumScript *create_script_from_source(const std::string &name,
+                                       const std::string &script_source,
+                                       GumScriptBackend *backend) {
+    std::string instrumented;
+    if (profile_hooks_) {
+      instrumented = profiler::instrumentScript(script_source);
+    }
+    const std::string &source = profile_hooks_ ? instrumented : script_source;
+
+    if (!script_cache_ || backend != backend_) {
+      return gum_script_backend_create_sync(backend, name.c_str(),
+                                            source.data(), nullptr,
+                                            cancellable_, &error_);
+    }
+
+    if (GBytes *cached = script_cache_->lookup(source)) {
+      GumScript *script = gum_script_backend_create_from_bytes_sync(
+          backend_, cached, nullptr, cancellable_, &error_);
+      g_bytes_unref(cached);
+      if (!error_) {
+        return script;
       }
+      logger::warn("Cached bytecode rejected: {}", error_->message);
+      g_clear_error(&error_);
+      script_cache_->invalidate(source);
+    }
+
+    GBytes *bytecode = gum_script_backend_compile_sync(
+        backend_, name.c_str(), source.data(), cancellable_, &error_);
+    if (error_) {
+      return nullptr;
+    }
+    script_cache_->store(source, bytecode);
+
+    GumScript *script = gum_script_backend_create_from_bytes_sync(
+        backend_, bytecode, nullptr, cancellable_, &error_);
+    g_bytes_unref(bytecode);
+    return script;
+  }
 
-      gum_script_set_message_handler(script_, on_message, nullptr, nullptr);
-      gum_script_load_sync(script_, cancellable_);
-      context_ = g_main_context_get_thread_default();
-      while (g_main_context_pending(context_)) {
-        g_main_context_iteration(context_, FALSE);
+  // Creates a script from bytecode if there is any, falling back to the
+  // source. Logs and returns nullptr on failure.
+  GumScript *create_script(const ScriptSource &source) {
+    GumScriptBackend *backend = backend_for(source.runtime);
+    // Bytecode only loads on QuickJS; with another engine it is the
+    // fallback for a missing source.
+    if (source.bytecode && (backend == backend_ || source.content.empty())) {
+      if (GumScript *script = create_script_from_bytecode(*source.bytecode)) {
+        if (profile_hooks_) {
+          logger::warn("Hook profiling does not apply to bytecode script {}",
+                       source.name);
+        }
+        return script;
       }
+      if (source.content.empty()) {
+        logger::error("Bytecode of {} rejected and no JS content to fall "
+                      "back to",
+                      source.name);
+        return nullptr;
+      }
+    }
 
-      promise.set_value();
-      loop_ = g_main_loop_new(g_main_context_get_thread_default(), FALSE);
-      g_main_loop_run(loop_);
-    }).detach();
-    // init_future.get();
-    return init_promise;
+    GumScript *script =
+        create_script_from_source(source.name, source.content, backend);
+    if (!script || error_) {
+      logger::error("Failed to create script {}: {}", source.name,
+                    error_ ? error_->message : "unknown error");
+      g_clear_error(&error_);
+      if (script) {
+        g_object_unref(script);
+      }
+      return nullptr;
+    }
+    logger::println("[*] Created Gum Script {}", source.name);
+    return script;
+  }
+
+  using SourceProvider = std::function<std::vector<ScriptSource>()>;
+
+  // Brings Gum up straight away and only then waits for the provider, so
+  // Gum, backend and hook setup overlap with decoding the config. Setters
+  // called before the provider is set take effect. The provider runs on
+  // the JS thread once Gum is up, so it may inspect the process (e.g.
+  // loaded modules) to decide what to load.
+  void start_js_thread(std::future<SourceProvider> provider) {
+    logger::println("[*] Starting GumJS hook thread");
+    std::thread thread([this, provider = std::move(provider)]() mutable {
+      try {
+        init_gum();
+        // Joins with the config thread.
+        load_scripts(provider.get(), std::nullopt);
+      } catch (const std::exception &e) {
+        logger::error("GumJS startup failed: {}", e.what());
+        return;
+      }
+      run_loop();
+    });
+    hook_thread_ = std::make_unique<std::thread>(std::move(thread));
+  }
+
+  // Does the JS thread's startup on the calling thread instead, and waits
+  // for the scripts to load until deadline. The JS thread then finishes any
+  // load still in flight and runs the loop. For the library constructor:
+  // the loader lock it holds is recursive, so Gum can enumerate modules
+  // here, where another thread would wait for the constructor to return.
+  void start_here(SourceProvider provider,
+                  std::chrono::steady_clock::time_point deadline) {
+    try {
+      init_gum();
+      load_scripts(std::move(provider), deadline);
+    } catch (const std::exception &e) {
+      logger::error("GumJS startup failed: {}", e.what());
+      return;
+    }
+    logger::println("[*] Starting GumJS hook thread");
+    hook_thread_ = std::make_unique<std::thread>([this]() { run_loop(); });
+  }
+
+  void set_unload_after(std::optional<uint32_t> ms) { unload_after_ms_ = ms; }
+
+  void set_probes(std::optional<config::ProbesConfig> probes) {
+    probes_ = std::move(probes);
+  }
+
+  void set_hook_profiling(std::optional<config::HookProfileConfig> profile) {
+    profile_hooks_ = std::move(profile);
+  }
+
+  void set_startup_report_path(std::optional<std::string> path) {
+    startup_report_path_ = std::move(path);
+  }
+
+  void set_post_startup_phases(bool post) { post_startup_phases_ = post; }
+
+  // Logs the phase timings and, if asked to, hands them to the scripts as
+  // {"type":"fripack:startup","phases":{...}}, for recv('fripack:startup').
+  void report_startup() {
+    startup::report(startup_report_path_);
+    if (!post_startup_phases_) {
+      return;
+    }
+    std::string message = "{\"type\":\"fripack:startup\",\"phases\":" +
+                          startup::toJson() + "}";
+    for (const auto &loaded : scripts_) {
+      gum_script_post(loaded.script, message.c_str(), nullptr);
+    }
   }
 
   std::string read_file_content(const std::string& filepath) {
     std::ifstream file(filepath);
     if (!file.is_open()) {
-      logger::println("Failed to open file: {}", filepath);
+      logger::error("Failed to open file: {}", filepath);
       return "";
     }
     
@@ -136,103 +413,391 @@ public:
     return content;
   }
 
-  void reload_script(const std::string& new_content) {
-    if (!script_) {
-      logger::println("No script to reload");
-      return;
+  // Runs fn on the context the script lives on. Returns false if the script
+  // has not been loaded yet.
+  bool invoke_on_script_context(std::function<void()> fn) {
+    GMainContext *context = context_;
+    if (!context) {
+      return false;
     }
 
+    g_main_context_invoke_full(
+        context, G_PRIORITY_DEFAULT,
+        [](gpointer user_data) -> gboolean {
+          (*static_cast<std::function<void()> *>(user_data))();
+          return G_SOURCE_REMOVE;
+        },
+        new std::function<void()>(std::move(fn)), [](gpointer user_data) {
+          delete static_cast<std::function<void()> *>(user_data);
+        });
+    return true;
+  }
+
+  // Safe to call from any thread: the reload is dispatched onto the
+  // context the script runs on.
+  void reload_script(std::string new_content) {
+    bool dispatched = invoke_on_script_context(
+        [this, new_content = std::move(new_content)]() {
+          swap_script(new_content);
+        });
+    if (!dispatched) {
+      logger::warn("No script to reload");
+    }
+  }
+
+  // Builds the replacement while the old script keeps its hooks installed,
+  // then unloads and loads back to back so the window without hooks is only
+  // as long as the swap itself. A script that fails to compile leaves the
+  // old one running.
+  bool swap_script(const std::string &new_content,
+                   std::string *error_message = nullptr) {
     logger::println("[*] Reloading script with new content");
-    
-    // Unload the old script
-    gum_script_unload_sync(script_, cancellable_);
-    
-    // Create new script with updated content
-    GumScript *new_script = gum_script_backend_create_sync(
-        backend_, "script", new_content.data(), nullptr, cancellable_, &error_);
-    
-    if (error_) {
-      logger::println("Failed to create new script: {}", error_->message);
-      g_error_free(error_);
-      error_ = nullptr;
-      return;
+    auto compile_start = std::chrono::steady_clock::now();
+
+    std::string name = scripts_.empty() ? "script" : scripts_.front().name;
+    GumScriptBackend *backend =
+        scripts_.empty() ? backend_ : scripts_.front().backend;
+    GumScript *new_script =
+        create_script_from_source(name, new_content, backend);
+    if (!new_script || error_) {
+      std::string reason = error_ ? error_->message : "unknown error";
+      logger::error("Failed to create new script, keeping the old one: {}",
+                    reason);
+      g_clear_error(&error_);
+      if (new_script) {
+        g_object_unref(new_script);
+      }
+      if (error_message) {
+        *error_message = std::move(reason);
+      }
+      metrics::recordReload(false, 0);
+      return false;
     }
+    gum_script_set_message_handler(new_script, on_message, this, nullptr);
 
-    // Clean up old script
-    g_object_unref(script_);
-    
-    // Set up new script
-    script_ = new_script;
-    gum_script_set_message_handler(script_, on_message, nullptr, nullptr);
-    gum_script_load_sync(script_, cancellable_);
-    
-    logger::println("[*] Script reloaded successfully");
+    auto swap_start = std::chrono::steady_clock::now();
+    GumScript *old_script =
+        scripts_.empty() ? nullptr : scripts_.front().script;
+    {
+      patching::Window window("reload");
+      if (old_script) {
+        gum_script_unload_sync(old_script, cancellable_);
+      }
+      // Unloading waits for the interceptor to flush, which cannot happen
+      // inside a transaction, so only the new script's hooks are batched.
+      patching::Transaction transaction;
+      gum_script_load_sync(new_script, cancellable_);
+    }
+    if (old_script) {
+      scripts_.front().script = new_script;
+    } else {
+      scripts_.push_back({std::move(name), new_script, backend});
+    }
+    auto swap_end = std::chrono::steady_clock::now();
+
+    if (old_script) {
+      g_object_unref(old_script);
+    }
+
+    logger::println(
+        "[*] Script reloaded successfully (compile {} us, swap {} us)",
+        std::chrono::duration_cast<std::chrono::microseconds>(swap_start -
+                                                              compile_start)
+            .count(),
+        std::chrono::duration_cast<std::chrono::microseconds>(swap_end -
+                                                              swap_start)
+            .count());
+    metrics::recordReload(
+        true, std::chrono::duration_cast<std::chrono::microseconds>(
+                  swap_end - compile_start)
+                  .count());
+    return true;
   }
 
-  void start_file_watcher(const std::string& watch_path) {
-    watch_path_ = watch_path;
-    should_stop_watching_ = false;
-    
-    // Get initial file write time
-    try {
-      last_write_time_ = std::filesystem::last_write_time(watch_path_);
-    } catch (const std::exception& e) {
-      logger::println("Failed to get initial file time: {}", e.what());
-      return;
+  control::Result run_control_command(const control::Command &command) {
+    switch (command.type) {
+    case control::CommandType::LoadScript: {
+      std::string error_message;
+      bool ok = swap_script(command.payload, &error_message);
+      return {ok, std::move(error_message)};
+    }
+    case control::CommandType::Post: {
+      if (scripts_.empty()) {
+        return {false, "No script loaded"};
+      }
+      GBytes *data =
+          command.data.empty()
+              ? nullptr
+              : g_bytes_new(command.data.data(), command.data.size());
+      gum_script_post(scripts_.front().script, command.payload.c_str(), data);
+      if (data) {
+        g_bytes_unref(data);
+      }
+      return {true, {}};
+    }
+    case control::CommandType::Unload:
+      // Carried out by the caller once the batch is answered.
+      return {true, {}};
+    default:
+      return {false, "Unsupported command"};
     }
+  }
 
-    watch_thread_ = std::make_unique<std::thread>([this]() {
-      logger::println("[*] Started watching file: {}", watch_path_);
-      
-      while (!should_stop_watching_) {
-        try {
-          auto current_write_time = std::filesystem::last_write_time(watch_path_);
-          
-          if (current_write_time != last_write_time_) {
-            logger::println("[*] File change detected, reloading...");
-            last_write_time_ = current_write_time;
-            
-            std::string new_content = read_file_content(watch_path_);
-            if (!new_content.empty()) {
-              reload_script(new_content);
+  void start_control_socket(const std::string &name) {
+    control_ = control::ControlServer::start(
+        name, [this](control::ControlServer &server, uint64_t client_id,
+                     std::vector<control::Command> batch) {
+          std::vector<control::CommandType> types;
+          for (const auto &command : batch) {
+            types.push_back(command.type);
+          }
+          bool unload =
+              std::ranges::find(types, control::CommandType::Unload) !=
+              types.end();
+          // Unloading stops this server, so it is only requested once the
+          // reply is out.
+          bool dispatched = invoke_on_script_context(
+              [this, &server, client_id, unload,
+               batch = std::move(batch)]() {
+                std::vector<control::Result> results;
+                results.reserve(batch.size());
+                for (const auto &command : batch) {
+                  results.push_back(run_control_command(command));
+                }
+                server.reply(client_id, results);
+                if (unload) {
+                  request_unload();
+                }
+              });
+          if (!dispatched) {
+            // Unloading does not need a loaded script.
+            std::vector<control::Result> results;
+            for (auto type : types) {
+              results.push_back(type == control::CommandType::Unload
+                                    ? control::Result{true, {}}
+                                    : control::Result{false,
+                                                      "Script not loaded yet"});
+            }
+            server.reply(client_id, results);
+            if (unload) {
+              request_unload();
             }
           }
-        } catch (const std::exception& e) {
-          logger::println("Error watching file: {}", e.what());
-        }
-        
-        // Check every 500ms
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        });
+  }
+
+  void start_file_watcher(const std::string &watch_path) {
+    watcher_ = std::make_unique<FileWatcher>(watch_path, [this, watch_path]() {
+      logger::println("[*] File change detected, reloading...");
+      std::string new_content = read_file_content(watch_path);
+      if (!new_content.empty()) {
+        reload_script(new_content);
       }
-      
-      logger::println("[*] File watcher stopped");
     });
+    watcher_->start();
   }
 
+  // Stops every thread the manager started and joins them. The scripts are
+  // unloaded on the JS thread on its way out. Must not be called from the
+  // JS thread itself.
   void stop() {
-    should_stop_watching_ = true;
-    
-    if (watch_thread_ && watch_thread_->joinable()) {
-      watch_thread_->join();
+    stopping_ = true;
+    if (metrics_) {
+      metrics_->stop();
     }
-    
-    if (loop_) {
-      g_main_loop_quit(loop_);
+    if (watcher_) {
+      watcher_->stop();
     }
 
+    if (control_) {
+      control_->stop();
+    }
+
+    // Once the context is published the JS thread checks stopping_ before
+    // it runs the loop, so either the loop is never entered or this quit
+    // reaches it.
+    invoke_on_script_context([this]() {
+      if (loop_) {
+        g_main_loop_quit(loop_);
+      }
+    });
+
     if (hook_thread_ && hook_thread_->joinable()) {
       hook_thread_->join();
     }
+
+    // After the scripts are gone, so the messages they sent while unloading
+    // are still handled.
+    if (drain_) {
+      drain_->stop();
+    }
   }
 
 private:
+  void init_gum() {
+    gum_init_embedded();
+    gum_initialized_ = true;
+    startup::mark(startup::Phase::GumInitialized);
+
+    backend_ = gum_script_backend_obtain_qjs();
+    logger::println("[*] Obtained Gum Script Backend");
+    startup::mark(startup::Phase::BackendObtained);
+
+    fripack::hooks::init();
+    startup::mark(startup::Phase::HooksInstalled);
+    // Here rather than on the first capture, which may be in a signal
+    // handler.
+    stacks::startSymbolizer();
+  }
+
+  // Creates the scripts and starts loading them, then waits for the loads
+  // until deadline (for good without one).
+  void load_scripts(SourceProvider load_sources,
+                    std::optional<std::chrono::steady_clock::time_point>
+                        deadline) {
+    if (probes_) {
+      probes::install(*probes_);
+    }
+    if (profile_hooks_) {
+      probes::startReporter(std::chrono::milliseconds(
+          profile_hooks_->report_interval_ms.value_or(10000)));
+    }
+
+    std::vector<ScriptSource> sources = load_sources();
+    startup::mark(startup::Phase::SourcesReady);
+
+    for (auto &source : sources) {
+      GumScript *script = create_script(source);
+      if (!script) {
+        continue;
+      }
+      gum_script_set_message_handler(script, on_message, this, nullptr);
+      scripts_.push_back(
+          {std::move(source.name), script, backend_for(source.runtime)});
+    }
+    // The engine holds its own copy of each script by now.
+    sources = {};
+    startup::mark(startup::Phase::ScriptsCreated);
+
+    // The hooks of every script go in as one batch once the last one has
+    // loaded. Completions are dispatched on a context of their own, so the
+    // thread that waits for them can change.
+    load_window_ = std::make_unique<patching::Window>("load");
+    load_transaction_ = std::make_unique<patching::Transaction>();
+    load_context_ = g_main_context_new();
+    g_main_context_push_thread_default(load_context_);
+    for (auto &loaded : scripts_) {
+      gum_script_load(loaded.script, cancellable_, on_script_loaded, this);
+      ++loads_pending_;
+    }
+    g_main_context_pop_thread_default(load_context_);
+    finish_loads(deadline);
+  }
+
+  static void on_script_loaded(GObject *object, GAsyncResult *result,
+                               gpointer user_data) {
+    gum_script_load_finish(GUM_SCRIPT(object), result);
+    --static_cast<GumJSHookManager *>(user_data)->loads_pending_;
+  }
+
+  // Dispatches load completions until every script is loaded or deadline
+  // passes. Once all are loaded, applies their hooks and reports startup.
+  void finish_loads(
+      std::optional<std::chrono::steady_clock::time_point> deadline) {
+    if (!load_context_) {
+      return;
+    }
+    auto now = std::chrono::steady_clock::now;
+    GSource *timeout = nullptr;
+    if (deadline && loads_pending_ > 0 && now() < *deadline) {
+      // Only wakes the iteration below up.
+      timeout = g_timeout_source_new(static_cast<guint>(
+          std::chrono::ceil<std::chrono::milliseconds>(*deadline - now())
+              .count()));
+      g_source_set_callback(
+          timeout, [](gpointer) -> gboolean { return G_SOURCE_REMOVE; },
+          nullptr, nullptr);
+      g_source_attach(timeout, load_context_);
+    }
+    while (loads_pending_ > 0 && (!deadline || now() < *deadline)) {
+      g_main_context_iteration(load_context_, TRUE);
+    }
+    if (timeout) {
+      g_source_destroy(timeout);
+      g_source_unref(timeout);
+    }
+    if (loads_pending_ > 0) {
+      logger::warn("{} of {} scripts still loading, continuing startup",
+                   loads_pending_, scripts_.size());
+      return;
+    }
+
+    load_transaction_.reset();
+    load_window_.reset();
+    g_main_context_unref(load_context_);
+    load_context_ = nullptr;
+    startup::mark(startup::Phase::ScriptsLoaded);
+    report_startup();
+  }
+
+  // JS thread, for as long as the scripts run.
+  void run_loop() {
+    finish_loads(std::nullopt);
+
+    GMainContext *context = g_main_context_ref_thread_default();
+    while (g_main_context_pending(context)) {
+      g_main_context_iteration(context, FALSE);
+    }
+
+    // Publishing the context opens the door for reloads, which are
+    // dispatched onto it from other threads.
+    context_ = context;
+    if (unload_after_ms_) {
+      GSource *timeout = g_timeout_source_new(*unload_after_ms_);
+      g_source_set_callback(
+          timeout,
+          [](gpointer) -> gboolean {
+            logger::println("[*] unload_after_ms reached");
+            request_unload();
+            return G_SOURCE_REMOVE;
+          },
+          nullptr, nullptr);
+      g_source_attach(timeout, context);
+      g_source_unref(timeout);
+    }
+    if (!stopping_) {
+      loop_ = g_main_loop_new(context, FALSE);
+      g_main_loop_run(loop_);
+    }
+    unload_scripts();
+  }
+
+  // JS thread. Unloading reverts the scripts' hooks; the native probes and
+  // the profiling reporter were started on this thread, so they stop here
+  // too.
+  void unload_scripts() {
+    {
+      patching::Window window("unload");
+      for (auto &loaded : scripts_) {
+        gum_script_unload_sync(loaded.script, cancellable_);
+        g_object_unref(loaded.script);
+      }
+      if (probes_) {
+        probes::uninstall();
+      }
+    }
+    logger::println("[*] Unloaded {} scripts", scripts_.size());
+    scripts_.clear();
+    probes::stopReporter();
+  }
+
   void cleanup() {
     stop();
 
-    if (script_) {
-      g_object_unref(script_);
-      script_ = nullptr;
+    for (auto &loaded : scripts_) {
+      g_object_unref(loaded.script);
     }
+    scripts_.clear();
 
     if (cancellable_) {
       g_object_unref(cancellable_);
@@ -244,60 +809,277 @@ private:
       loop_ = nullptr;
     }
 
+    if (GMainContext *context = context_.exchange(nullptr)) {
+      g_main_context_unref(context);
+    }
+
     if (error_) {
       g_error_free(error_);
       error_ = nullptr;
     }
+
+    // Their threads are joined; they still hold GLib objects.
+    drain_.reset();
+    control_.reset();
+    watcher_.reset();
+
+    // Left over only when startup failed half-way.
+    load_transaction_.reset();
+    load_window_.reset();
+    if (load_context_) {
+      g_main_context_unref(load_context_);
+      load_context_ = nullptr;
+    }
+
+    if (gum_initialized_) {
+      gum_deinit_embedded();
+      gum_initialized_ = false;
+      hooks::deinit();
+    }
   }
 };
 
-void _fi_main() {
-  logger::println("[*] Library loaded, starting GumJS hook");
+// The running agent and the threads that outlive _fi_main, for the unload
+// paths. Threads are held by pointer so that no static destructor finds one
+// joinable at exit().
+std::mutex g_agent_mutex;
+GumJSHookManager *g_agent = nullptr;
+std::thread *g_config_thread = nullptr;
+bool g_unloaded = false;
+std::once_flag g_unload_requested;
+std::thread *g_unload_thread = nullptr;
+
+// On dlclose() static destructors run after the library destructor, on
+// exit() before it. Once this has run the process is exiting, the statics
+// the agent needs are gone, and there is nothing to unload.
+bool g_statics_destroyed = false;
+struct StaticsSentinel {
+  ~StaticsSentinel() { g_statics_destroyed = true; }
+} g_statics_sentinel;
 
-  // logger::println("Embedded config offset: {}, size: {}, JSON: {}",
-  //                 g_embedded_config.data_offset, g_embedded_config.data_size,
-  //                 json_str);
+// Stops the agent and everything it started: threads, scripts, hooks and
+// Gum itself. Runs once; later calls return straight away.
+void unload() {
+  std::lock_guard lock(g_agent_mutex);
+  if (g_unloaded) {
+    return;
+  }
+  g_unloaded = true;
+  auto start = std::chrono::steady_clock::now();
+  logger::println("[*] Unloading");
+
+  if (g_config_thread) {
+    g_config_thread->join();
+    delete g_config_thread;
+    g_config_thread = nullptr;
+  }
+  // The symbolizer asks Gum about modules, so it stops before Gum does.
+  stacks::stopSymbolizer();
+  delete g_agent;
+  g_agent = nullptr;
+  // Gum is gone, and with it every hook that could still record.
+  probes::releaseAll();
+
+  logger::println(
+      "[*] Unloaded in {} us",
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+}
+
+// Unloads from a thread of its own, so the JS and control socket threads,
+// which unload() joins, can ask for it.
+void request_unload() {
+  std::call_once(g_unload_requested,
+                 []() { g_unload_thread = new std::thread(unload); });
+}
+
+// Library unload: finishes an unload already under way, or runs one here.
+void unload_and_wait() {
+  if (g_statics_destroyed) {
+    return;
+  }
+  bool requested_here = false;
+  std::call_once(g_unload_requested, [&]() { requested_here = true; });
+  if (requested_here) {
+    unload();
+  } else if (g_unload_thread) {
+    g_unload_thread->join();
+    delete g_unload_thread;
+    g_unload_thread = nullptr;
+  }
+  logger::shutdown();
+}
+
+// Reads the embedded config and applies it to the agent. Returns what
+// provides the script sources, or nothing if the config is unusable.
+std::optional<GumJSHookManager::SourceProvider>
+configure(GumJSHookManager *agent) {
+  config::EmbeddedConfigData config;
   try {
-    std::thread([=]() {
-      GumJSHookManager *gumjs_hook_manager;
-      auto config = fripack::config::configData();
+    config = fripack::config::readConfig();
+  } catch (const std::exception &e) {
+    logger::error("Failed to read embedded config: {}", e.what());
+    return std::nullopt;
+  }
+  startup::mark(startup::Phase::ConfigDecoded);
+  if (config.mapped_file_cache_prefixes) {
+    hooks::configure(*config.mapped_file_cache_prefixes);
+  }
+  if (config.cache_dir) {
+    symbols::setCacheDir(std::filesystem::path(*config.cache_dir) / "symidx");
+  }
+
+  agent->set_startup_report_path(config.startup_report_path);
+  agent->set_post_startup_phases(config.post_startup_phases.value_or(false));
+  agent->set_probes(config.probes);
+  agent->set_message_backpressure(
+      config.message_backpressure.value_or(config::Backpressure::Block));
+  agent->set_hook_profiling(config.profile_hooks);
+  agent->set_unload_after(config.unload_after_ms);
+  if (config.metrics) {
+    agent->set_metrics(metrics::MetricsPublisher::open(
+        config.metrics->path,
+        std::chrono::milliseconds(config.metrics->interval_ms.value_or(1000))));
+  }
+  if (config.trace) {
+    agent->set_trace_recorder(trace::TraceRecorder::open(
+        config.trace->path,
+        config.trace->size_bytes.value_or(64 * 1024 * 1024)));
+  }
+  // Before the sources are handed over: the message thread reads
+  // control_ once scripts run, and the handover orders it after this.
+  if (config.control_socket) {
+    agent->start_control_socket(*config.control_socket);
+  }
+
+  // The script text is moved, never copied, from the parsed config to the
+  // engine. The provider runs once.
+  auto runtime = config.runtime.value_or(config::Runtime::QuickJs);
+  auto single_script = [runtime](std::string content,
+                                 std::optional<std::string> bytecode = {}) {
+    return [content = std::move(content), bytecode = std::move(bytecode),
+            runtime]() mutable {
+      std::vector<GumJSHookManager::ScriptSource> sources;
+      sources.push_back(
+          {"script", std::move(content), std::move(bytecode), runtime});
+      return sources;
+    };
+  };
 
-      gumjs_hook_manager = new GumJSHookManager();
-      std::string js_content;
+  if (config.mode == config::EmbeddedConfigData::Mode::EmbedJs) {
+    if (config.js_content) {
+      return single_script(std::move(*config.js_content));
+    } else {
+      logger::error("No JS content provided for EmbedJs mode");
+      return std::nullopt;
+    }
+  } else if (config.mode == config::EmbeddedConfigData::Mode::EmbedBytecode) {
+    if (config.js_bytecode) {
+      return single_script(std::move(config.js_content).value_or(""),
+                           std::move(config.js_bytecode));
+    } else {
+      logger::error("No JS bytecode provided for EmbedBytecode mode");
+      return std::nullopt;
+    }
+  } else if (config.mode == config::EmbeddedConfigData::Mode::WatchPath) {
+    if (config.watch_path) {
+      if (config.cache_dir) {
+        agent->set_script_cache(std::make_unique<ScriptCache>(
+            *config.cache_dir,
+            config.cache_max_bytes.value_or(32 * 1024 * 1024)));
+      }
+
+      std::string js_content = agent->read_file_content(*config.watch_path);
+      if (js_content.empty()) {
+        logger::error("Failed to read initial JS content from: {}", *config.watch_path);
+        return std::nullopt;
+      }
       
-      if (config.mode == config::EmbeddedConfigData::Mode::EmbedJs) {
-        if (config.js_content) {
-          js_content = *config.js_content;
-          gumjs_hook_manager->start_js_thread(js_content);
-        } else {
-          logger::println("No JS content provided for EmbedJs mode");
-          return;
-        }
-      } else if (config.mode == config::EmbeddedConfigData::Mode::WatchPath) {
-        if (config.watch_path) {
-          js_content = gumjs_hook_manager->read_file_content(*config.watch_path);
-          if (js_content.empty()) {
-            logger::println("Failed to read initial JS content from: {}", *config.watch_path);
-            return;
+      agent->start_file_watcher(*config.watch_path);
+      return single_script(std::move(js_content));
+    } else {
+      logger::error("No watch path provided for WatchPath mode");
+      return std::nullopt;
+    }
+  } else if (config.mode == config::EmbeddedConfigData::Mode::MultiScript) {
+    if (config.scripts) {
+      auto load_sources = [entries = std::move(*config.scripts), runtime]() {
+        std::vector<GumJSHookManager::ScriptSource> sources;
+        for (const auto *entry : config::selectScripts(entries)) {
+          try {
+            sources.push_back({entry->name,
+                               config::readEmbeddedScript(*entry),
+                               {},
+                               entry->runtime.value_or(runtime)});
+          } catch (const std::exception &e) {
+            logger::error("Failed to read embedded script {}: {}",
+                          entry->name, e.what());
           }
-          
-          auto init_promise = gumjs_hook_manager->start_js_thread(js_content);
-
-          gumjs_hook_manager->start_file_watcher(*config.watch_path);
-        } else {
-          logger::println("No watch path provided for WatchPath mode");
-          return;
         }
-      } else {
-        logger::println("Unsupported embedded config mode: {}",
-                        static_cast<int32_t>(config.mode));
-        return;
+        return sources;
+      };
+      return load_sources;
+    } else {
+      logger::error("No scripts provided for MultiScript mode");
+      return std::nullopt;
+    }
+  } else {
+    logger::error("Unsupported embedded config mode: {}",
+                  static_cast<int32_t>(config.mode));
+    return std::nullopt;
+  }
+}
+
+void _fi_main() {
+  auto start = std::chrono::steady_clock::now();
+  startup::mark(startup::Phase::LibraryLoaded);
+  logger::println("[*] Library loaded, starting GumJS hook");
+
+  uint32_t wait_ms = config::waitForLoadMs();
+#ifdef _WIN32
+  // DllMain runs under the loader lock, and the threads Gum starts and
+  // waits for cannot run until it is released.
+  if (wait_ms != 0) {
+    logger::warn("wait_for_load_ms is not supported on Windows");
+    wait_ms = 0;
+  }
+#endif
+
+  try {
+    std::lock_guard lock(g_agent_mutex);
+    auto *gumjs_hook_manager = new GumJSHookManager();
+    g_agent = gumjs_hook_manager;
+
+    if (wait_ms != 0) {
+      // Everything up to the script loads runs here, so that none of it
+      // waits for the loader lock this constructor runs under.
+      if (auto provider = configure(gumjs_hook_manager)) {
+        gumjs_hook_manager->start_here(
+            std::move(*provider), start + std::chrono::milliseconds(wait_ms));
       }
-    }).detach();
+      logger::println(
+          "[*] Spent {} us in the constructor",
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count());
+      return;
+    }
+
+    // Gum starts up on the JS thread while the config is decoded here; the
+    // two meet when the config thread hands over the script sources.
+    std::promise<GumJSHookManager::SourceProvider> sources;
+    gumjs_hook_manager->start_js_thread(sources.get_future());
+    g_config_thread = new std::thread(
+        [gumjs_hook_manager, sources = std::move(sources)]() mutable {
+          startup::mark(startup::Phase::ConfigThreadStarted);
+          if (auto provider = configure(gumjs_hook_manager)) {
+            sources.set_value(std::move(*provider));
+          }
+        });
   } catch (const std::exception &e) {
-    logger::println("Exception while parsing embedded config data: {}",
-                    e.what());
-    return;
+    logger::error("Exception while parsing embedded config data: {}",
+                  e.what());
   }
 }
 } // namespace fripack
@@ -309,6 +1091,8 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
     fripack::_fi_main();
     break;
   case DLL_PROCESS_DETACH:
+    // Threads cannot be joined under the loader lock, so FreeLibrary() is
+    // only clean after fripack_unload() has finished.
     break;
   }
   return TRUE;
@@ -317,4 +1101,12 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
 __attribute__((constructor)) static void _library_main() {
   fripack::_fi_main();
 }
-#endif
\ No newline at end of file
+
+__attribute__((destructor)) static void _library_exit() {
+  fripack::unload_and_wait();
+}
+#endif
+
+// For scripts: new NativeFunction(<export>, 'void', [])(). Returns straight
+// away; the agent unloads from a thread of its own.
+extern "C" EXPORT void fripack_unload() { fripack::request_unload(); }
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "message.h"
+
+#include <cstdint>
+
+namespace fripack::message {
+
+namespace {
+constexpr std::string_view kLogPrefix = R"({"type":"log","level":")";
+constexpr std::string_view kLogPayloadKey = R"(","payload":")";
+constexpr std::string_view kSendPrefix = R"({"type":"send","payload":)";
+constexpr std::string_view kTypePrefix = R"({"type":")";
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+bool read_hex4(std::string_view in, size_t pos, uint32_t &out) {
+  if (pos + 4 > in.size()) {
+    return false;
+  }
+  out = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    int v = hex_value(in[pos + i]);
+    if (v < 0) {
+      return false;
+    }
+    out = (out << 4) | static_cast<uint32_t>(v);
+  }
+  return true;
+}
+
+void append_utf8(std::string &out, uint32_t cp) {
+  if (cp < 0x80) {
+    out.push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+  } else if (cp < 0x10000) {
+    out.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+  } else {
+    out.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+  }
+}
+
+// Decodes the JSON string body starting at pos (just past the opening
+// quote) and leaves pos on the closing quote.
+bool read_string(std::string_view in, size_t &pos, std::string &out) {
+  out.clear();
+  while (pos < in.size()) {
+    size_t run = pos;
+    while (run < in.size() && in[run] != '"' && in[run] != '\\') {
+      ++run;
+    }
+    out.append(in.data() + pos, run - pos);
+    pos = run;
+    if (pos >= in.size()) {
+      return false;
+    }
+    if (in[pos] == '"') {
+      return true;
+    }
+
+    if (++pos >= in.size()) {
+      return false;
+    }
+    char esc = in[pos++];
+    switch (esc) {
+    case '"':
+    case '\\':
+    case '/':
+      out.push_back(esc);
+      break;
+    case 'b':
+      out.push_back('\b');
+      break;
+    case 'f':
+      out.push_back('\f');
+      break;
+    case 'n':
+      out.push_back('\n');
+      break;
+    case 'r':
+      out.push_back('\r');
+      break;
+    case 't':
+      out.push_back('\t');
+      break;
+    case 'u': {
+      uint32_t cp;
+      if (!read_hex4(in, pos, cp)) {
+        return false;
+      }
+      pos += 4;
+      if (cp >= 0xd800 && cp < 0xdc00) {
+        uint32_t low;
+        if (pos + 6 <= in.size() && in[pos] == '\\' && in[pos + 1] == 'u' &&
+            read_hex4(in, pos + 2, low) && low >= 0xdc00 && low < 0xe000) {
+          cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+          pos += 6;
+        } else {
+          cp = 0xfffd;
+        }
+      } else if (cp >= 0xdc00 && cp < 0xe000) {
+        cp = 0xfffd;
+      }
+      append_utf8(out, cp);
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+} // namespace
+
+bool classify(std::string_view raw, Message &out) {
+  if (raw.starts_with(kLogPrefix)) {
+    size_t level_start = kLogPrefix.size();
+    size_t level_end = raw.find('"', level_start);
+    if (level_end == std::string_view::npos ||
+        raw.compare(level_end, kLogPayloadKey.size(), kLogPayloadKey) != 0) {
+      return false;
+    }
+
+    size_t pos = level_end + kLogPayloadKey.size();
+    if (!read_string(raw, pos, out.text) || raw.substr(pos) != "\"}") {
+      return false;
+    }
+
+    out.type = Type::Log;
+    out.level = raw.substr(level_start, level_end - level_start);
+    return true;
+  }
+
+  if (raw.starts_with(kSendPrefix)) {
+    if (!raw.ends_with('}')) {
+      return false;
+    }
+    out.type = Type::Send;
+    out.payload = raw.substr(kSendPrefix.size(),
+                             raw.size() - kSendPrefix.size() - 1);
+    return true;
+  }
+
+  if (raw.starts_with(kTypePrefix)) {
+    out.type = Type::Other;
+    return true;
+  }
+
+  return false;
+}
+
+} // namespace fripack::message
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+namespace fripack::message {
+
+enum class Type {
+  Log,
+  Send,
+  Other,
+};
+
+struct Message {
+  Type type = Type::Other;
+  // Log: console method level ("info", "warning", "error", "debug").
+  std::string_view level;
+  // Log: the unescaped text.
+  std::string text;
+  // Send: raw JSON of the payload, pointing into the original message.
+  std::string_view payload;
+};
+
+// Recognizes the exact layouts Gum's runtime produces for console.* and
+// send() by matching their fixed prefixes, without building a JSON tree.
+// Returns false for anything else, in which case the caller should fall back
+// to a full JSON parse.
+bool classify(std::string_view raw, Message &out);
+
+} // namespace fripack::message
@@ -0,0 +1,137 @@
+#include "message_drain.h"
+#include "export.h"
+#include "logger.h"
+
+namespace fripack::message {
+
+namespace {
+std::atomic<uint64_t> g_queued{0};
+std::atomic<uint64_t> g_handled{0};
+std::atomic<uint64_t> g_dropped_oldest{0};
+std::atomic<uint64_t> g_dropped_newest{0};
+std::atomic<uint64_t> g_blocked{0};
+
+uint64_t total_dropped() {
+  return g_dropped_oldest.load(std::memory_order_relaxed) +
+         g_dropped_newest.load(std::memory_order_relaxed);
+}
+} // namespace
+
+Drain::Drain(Backpressure policy, Sink sink)
+    : policy_(policy), sink_(std::move(sink)),
+      reported_dropped_(total_dropped()), consumer_([this]() { run(); }) {}
+
+Drain::~Drain() { stop(); }
+
+void Drain::push(const gchar *message, GBytes *data) {
+  Queued item{message, data ? g_bytes_ref(data) : nullptr};
+  bool counted_block = false;
+
+  while (!queue_.try_push(std::move(item))) {
+    if (policy_ == Backpressure::DropNewest) {
+      if (item.data) {
+        g_bytes_unref(item.data);
+      }
+      g_dropped_newest.fetch_add(1, std::memory_order_relaxed);
+      wake_consumer();
+      return;
+    }
+
+    if (policy_ == Backpressure::DropOldest) {
+      if (auto oldest = queue_.try_pop()) {
+        if (oldest->data) {
+          g_bytes_unref(oldest->data);
+        }
+        g_dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+      }
+      continue;
+    }
+
+    if (!counted_block) {
+      g_blocked.fetch_add(1, std::memory_order_relaxed);
+      counted_block = true;
+    }
+    uint32_t generation = handled_generation_.load(std::memory_order_acquire);
+    blocked_producers_.fetch_add(1, std::memory_order_seq_cst);
+    wake_consumer();
+    if (queue_.try_push(std::move(item))) {
+      blocked_producers_.fetch_sub(1, std::memory_order_relaxed);
+      break;
+    }
+    handled_generation_.wait(generation, std::memory_order_acquire);
+    blocked_producers_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  g_queued.fetch_add(1, std::memory_order_relaxed);
+  wake_consumer();
+}
+
+void Drain::wake_consumer() {
+  if (consumer_sleeping_.exchange(false)) {
+    consumer_sleeping_.notify_one();
+  }
+}
+
+void Drain::run() {
+  while (true) {
+    while (auto item = queue_.try_pop()) {
+      sink_(item->message, item->data);
+      if (item->data) {
+        g_bytes_unref(item->data);
+      }
+      g_handled.fetch_add(1, std::memory_order_relaxed);
+      handled_generation_.fetch_add(1, std::memory_order_release);
+      if (blocked_producers_.load(std::memory_order_seq_cst) != 0) {
+        handled_generation_.notify_all();
+      }
+    }
+
+    uint64_t dropped = total_dropped();
+    if (dropped != reported_dropped_) {
+      logger::warn("Message queue full, dropped {} messages",
+                   dropped - reported_dropped_);
+      reported_dropped_ = dropped;
+    }
+
+    if (stopping_.load()) {
+      return;
+    }
+    consumer_sleeping_.store(true);
+    if (!queue_.empty() || stopping_.load()) {
+      consumer_sleeping_.store(false);
+      continue;
+    }
+    consumer_sleeping_.wait(true);
+  }
+}
+
+void Drain::stop() {
+  if (!consumer_.joinable()) {
+    return;
+  }
+  stopping_.store(true);
+  consumer_sleeping_.store(false);
+  consumer_sleeping_.notify_one();
+  consumer_.join();
+}
+
+DrainStats Drain::stats() {
+  return {g_queued.load(std::memory_order_relaxed),
+          g_handled.load(std::memory_order_relaxed),
+          g_dropped_oldest.load(std::memory_order_relaxed),
+          g_dropped_newest.load(std::memory_order_relaxed),
+          g_blocked.load(std::memory_order_relaxed)};
+}
+
+} // namespace fripack::message
+
+// Called like fripack_startup_phases().
+extern "C" EXPORT size_t fripack_message_stats(char *buffer, size_t size) {
+  auto stats = fripack::message::Drain::stats();
+  return fripack::copyOut(
+      fmt::format("{{\"queued\":{},\"handled\":{},\"dropped_oldest\":{},"
+                  "\"dropped_newest\":{},\"blocked\":{}}}",
+                  stats.queued, stats.handled, stats.dropped_oldest,
+                  stats.dropped_newest, stats.blocked),
+      buffer, size);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "config.h"
+#include "frida-gumjs.h"
+
+namespace fripack::message {
+
+using config::Backpressure;
+
+struct DrainStats {
+  uint64_t queued;
+  uint64_t handled;
+  uint64_t dropped_oldest;
+  uint64_t dropped_newest;
+  uint64_t blocked;
+};
+
+// Moves message handling off the script's thread: push() copies the message
+// (and takes a reference on its data) into a lock-free queue, and a
+// dedicated thread hands each one to the sink in order.
+class Drain {
+public:
+  using Sink = std::function<void(std::string_view message, GBytes *data)>;
+
+  Drain(Backpressure policy, Sink sink);
+  ~Drain();
+
+  Drain(const Drain &) = delete;
+  Drain &operator=(const Drain &) = delete;
+
+  void push(const gchar *message, GBytes *data);
+
+  // Stops the consumer after it has handled everything already queued.
+  void stop();
+
+  // Counters of every drain in the process.
+  static DrainStats stats();
+
+private:
+  static constexpr size_t kCapacity = 4096;
+
+  struct Queued {
+    std::string message;
+    GBytes *data = nullptr;
+  };
+
+  void run();
+  void wake_consumer();
+
+  Backpressure policy_;
+  Sink sink_;
+  BoundedQueue<Queued, kCapacity> queue_;
+  // Same parking scheme as the logger's writer: no periodic wakeups while
+  // idle.
+  std::atomic<bool> consumer_sleeping_{false};
+  std::atomic<bool> stopping_{false};
+  // Bumped per handled message; blocked producers wait on it.
+  std::atomic<uint32_t> handled_generation_{0};
+  std::atomic<uint32_t> blocked_producers_{0};
+  // Consumer-only; drops before this drain existed are not its to report.
+  uint64_t reported_dropped_;
+  std::thread consumer_;
+};
+
+} // namespace fripack::message
@@ -0,0 +1,224 @@
+#include "metrics.h"
+#include "logger.h"
+#include "message_drain.h"
+#include "probe_stats.h"
+#include "startup.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace fripack::metrics {
+namespace {
+std::atomic<uint64_t> g_reloads{0};
+std::atomic<uint64_t> g_reload_failures{0};
+std::atomic<uint64_t> g_last_reload_us{0};
+std::atomic<uint64_t> g_total_reload_us{0};
+
+#ifndef _WIN32
+uint64_t heap_bytes() {
+#if defined(__ANDROID__)
+  return mallinfo().uordblks;
+#elif defined(__GLIBC__) &&                                                    \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+uint64_t realtime_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+#endif
+} // namespace
+
+void recordReload(bool ok, uint64_t duration_us) {
+  if (!ok) {
+    g_reload_failures.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  g_reloads.fetch_add(1, std::memory_order_relaxed);
+  g_last_reload_us.store(duration_us, std::memory_order_relaxed);
+  g_total_reload_us.fetch_add(duration_us, std::memory_order_relaxed);
+}
+
+#ifndef _WIN32
+MetricsPublisher::MetricsPublisher(int fd, Segment *segment,
+                                   std::chrono::milliseconds interval)
+    : fd_(fd), segment_(segment), interval_(interval),
+      thread_([this]() { run(); }) {}
+
+MetricsPublisher::~MetricsPublisher() {
+  stop();
+  munmap(segment_, sizeof(Segment));
+  close(fd_);
+}
+
+std::unique_ptr<MetricsPublisher>
+MetricsPublisher::open(std::optional<std::string> path,
+                       std::chrono::milliseconds interval) {
+  interval = std::max(interval, std::chrono::milliseconds(10));
+  int fd;
+  std::string where;
+  std::string tmp_path;
+  if (path) {
+    if (auto pos = path->find("{pid}"); pos != std::string::npos) {
+      path->replace(pos, 5, std::to_string(getpid()));
+    }
+    // Built under a name of its own and renamed over the path once set up,
+    // so a reader never sees it half-initialized, and one still holding a
+    // previous run's segment keeps that file rather than having it
+    // truncated under its mapping.
+    tmp_path = *path + ".XXXXXX";
+    fd = mkstemp(tmp_path.data());
+    if (fd != -1) {
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+      fchmod(fd, 0644);
+    }
+    where = *path;
+  } else {
+    // The libc wrapper is missing from older Android releases.
+    fd = static_cast<int>(syscall(SYS_memfd_create, "fripack-metrics",
+                                  MFD_CLOEXEC));
+    where = fmt::format("/proc/{}/fd/{}", getpid(), fd);
+  }
+  if (fd == -1) {
+    logger::error("Failed to create metrics segment: {}", strerror(errno));
+    return nullptr;
+  }
+
+  auto fail = [&](const char *what) {
+    logger::error("Failed to {} metrics segment: {}", what, strerror(errno));
+    close(fd);
+    if (!tmp_path.empty()) {
+      unlink(tmp_path.c_str());
+    }
+    return nullptr;
+  };
+  if (ftruncate(fd, sizeof(Segment)) == -1) {
+    return fail("size");
+  }
+  void *base = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    return fail("map");
+  }
+
+  auto *segment = static_cast<Segment *>(base);
+  *segment = {};
+  segment->magic = kMagic;
+  segment->version = kVersion;
+  segment->size = sizeof(Segment);
+  segment->state = static_cast<uint32_t>(State::Running);
+  segment->pid = static_cast<uint32_t>(getpid());
+  segment->interval_ms = static_cast<uint32_t>(interval.count());
+  if (!tmp_path.empty() && rename(tmp_path.c_str(), path->c_str()) == -1) {
+    munmap(base, sizeof(Segment));
+    return fail("publish");
+  }
+
+  logger::println("[*] Publishing metrics to {} every {} ms", where,
+                  interval.count());
+  return std::unique_ptr<MetricsPublisher>(
+      new MetricsPublisher(fd, segment, interval));
+}
+
+void MetricsPublisher::stop() {
+  {
+    std::lock_guard lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  publish();
+  std::atomic_ref(segment_->state)
+      .store(static_cast<uint32_t>(State::Stopped), std::memory_order_release);
+}
+
+void MetricsPublisher::run() {
+  std::unique_lock lock(mutex_);
+  while (!cv_.wait_for(lock, interval_, [this]() { return stopping_; })) {
+    lock.unlock();
+    publish();
+    lock.lock();
+  }
+}
+
+// Only this object writes the segment, and only one thread at a time: the
+// publisher thread, or stop() once that has been joined.
+void MetricsPublisher::publish() {
+  Counters counters{};
+  counters.uptime_ns = startup::sinceLoadNs();
+  counters.updated_ns = realtime_ns();
+
+  auto messages = message::Drain::stats();
+  counters.messages_queued = messages.queued;
+  counters.messages_handled = messages.handled;
+  counters.messages_dropped = messages.dropped_oldest + messages.dropped_newest;
+  counters.messages_blocked = messages.blocked;
+  counters.log_bytes = logger::written_bytes();
+  counters.log_dropped = logger::dropped_count();
+
+  counters.reloads = g_reloads.load(std::memory_order_relaxed);
+  counters.reload_failures = g_reload_failures.load(std::memory_order_relaxed);
+  counters.last_reload_us = g_last_reload_us.load(std::memory_order_relaxed);
+  counters.total_reload_us = g_total_reload_us.load(std::memory_order_relaxed);
+  counters.heap_bytes = heap_bytes();
+
+  auto hooks = probes::snapshot();
+  counters.hook_count = hooks.size();
+  for (size_t i = 0; i < hooks.size(); ++i) {
+    counters.hook_calls += hooks[i].calls;
+    if (i < kMaxHooks) {
+      Hook &hook = counters.hooks[i];
+      size_t length = std::min(hooks[i].name.size(), kHookNameSize - 1);
+      std::memcpy(hook.name, hooks[i].name.data(), length);
+      hook.calls = hooks[i].calls;
+      hook.total_ns = hooks[i].total_ns;
+    }
+  }
+
+  std::atomic_ref seq(segment_->seq);
+  uint32_t start = seq.load(std::memory_order_relaxed);
+  seq.store(start + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(&segment_->counters, &counters, sizeof(counters));
+  seq.store(start + 2, std::memory_order_release);
+}
+#else
+MetricsPublisher::MetricsPublisher(int fd, Segment *segment,
+                                   std::chrono::milliseconds interval)
+    : fd_(fd), segment_(segment), interval_(interval) {}
+
+MetricsPublisher::~MetricsPublisher() = default;
+
+std::unique_ptr<MetricsPublisher>
+MetricsPublisher::open(std::optional<std::string> path,
+                       std::chrono::milliseconds interval) {
+  logger::warn("Metrics segment is not supported on this platform");
+  return nullptr;
+}
+
+void MetricsPublisher::stop() {}
+void MetricsPublisher::run() {}
+void MetricsPublisher::publish() {}
+#endif
+} // namespace fripack::metrics
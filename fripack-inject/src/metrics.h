@@ -0,0 +1,51 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "metrics_format.h"
+
+namespace fripack::metrics {
+// Publishes the agent's counters into a small shared-memory segment that
+// local tools can map and poll (fripack-metrics-read) without talking to
+// the agent. A background thread refreshes it every interval.
+class MetricsPublisher {
+public:
+  ~MetricsPublisher();
+
+  MetricsPublisher(const MetricsPublisher &) = delete;
+  MetricsPublisher &operator=(const MetricsPublisher &) = delete;
+
+  // Creates (or truncates) the file at path, "{pid}" replaced with the
+  // process id, or an anonymous memfd named "fripack-metrics" when path is
+  // unset. Returns nullptr on failure or on platforms without mmap.
+  static std::unique_ptr<MetricsPublisher>
+  open(std::optional<std::string> path, std::chrono::milliseconds interval);
+
+  // Writes a last update, marks the segment stopped and joins the thread.
+  void stop();
+
+private:
+  MetricsPublisher(int fd, Segment *segment,
+                   std::chrono::milliseconds interval);
+
+  void run();
+  void publish();
+
+  int fd_;
+  Segment *segment_;
+  std::chrono::milliseconds interval_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+// Counted here because the publisher reads them; called by the reload path.
+void recordReload(bool ok, uint64_t duration_us);
+} // namespace fripack::metrics
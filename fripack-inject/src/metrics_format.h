@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Layout of the live metrics segment, shared by the agent and the host-side
+// reader. All integers are little-endian.
+//
+// The agent rewrites Counters every interval_ms under a seqlock: seq is odd
+// while an update is in progress. A reader copies Counters between two
+// acquire loads of seq and retries unless both saw the same even value.
+namespace fripack::metrics {
+
+constexpr uint32_t kMagic = 0x544d5046; // "FPMT"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kMaxHooks = 64;
+constexpr size_t kHookNameSize = 48;
+
+enum class State : uint32_t {
+  Running = 1,
+  Stopped = 2,
+};
+
+struct Hook {
+  char name[kHookNameSize]; // NUL-terminated, truncated if longer.
+  uint64_t calls;
+  uint64_t total_ns;
+};
+
+struct Counters {
+  uint64_t uptime_ns; // Since the library was loaded.
+  uint64_t updated_ns; // CLOCK_REALTIME of this update.
+  uint64_t messages_queued;
+  uint64_t messages_handled;
+  uint64_t messages_dropped;
+  uint64_t messages_blocked;
+  uint64_t log_bytes;
+  uint64_t log_dropped;
+  uint64_t reloads;
+  uint64_t reload_failures;
+  uint64_t last_reload_us;
+  uint64_t total_reload_us;
+  // malloc bytes in use by the whole process, script engines included;
+  // Gum has no per-script figure.
+  uint64_t heap_bytes;
+  // Native probes and profiled JS hooks; hooks beyond kMaxHooks are only
+  // in hook_calls.
+  uint64_t hook_count;
+  uint64_t hook_calls;
+  uint64_t reserved[9];
+  Hook hooks[kMaxHooks];
+};
+
+struct Segment {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size; // sizeof(Segment).
+  uint32_t state;
+  uint32_t pid;
+  uint32_t interval_ms;
+  uint32_t seq;
+  uint32_t reserved;
+  Counters counters;
+};
+
+static_assert(sizeof(Hook) == 64);
+static_assert(sizeof(Counters) == 192 + kMaxHooks * sizeof(Hook));
+static_assert(sizeof(Segment) == 32 + sizeof(Counters));
+
+} // namespace fripack::metrics
@@ -0,0 +1,177 @@
+#include "patch_window.h"
+#include "export.h"
+#include "logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include "frida-gumjs.h"
+
+namespace fripack::patching {
+namespace {
+struct WindowStats {
+  int64_t changes;
+  uint64_t batches;
+  int64_t commit_us;
+  int64_t window_us;
+};
+
+#ifdef FRIPACK_COUNT_INTERCEPTOR_CHANGES
+std::atomic<int64_t> g_changes{0};
+#endif
+std::atomic<uint64_t> g_commits{0};
+std::atomic<uint64_t> g_commit_ns{0};
+
+std::mutex g_windows_mutex;
+std::map<std::string, WindowStats> g_windows;
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t changes() {
+#ifdef FRIPACK_COUNT_INTERCEPTOR_CHANGES
+  return g_changes.load(std::memory_order_relaxed);
+#else
+  return -1;
+#endif
+}
+} // namespace
+
+Transaction::Transaction() {
+  GumInterceptor *interceptor = gum_interceptor_obtain();
+  gum_interceptor_begin_transaction(interceptor);
+  g_object_unref(interceptor);
+}
+
+Transaction::~Transaction() {
+  GumInterceptor *interceptor = gum_interceptor_obtain();
+  int64_t start = now_ns();
+  gum_interceptor_end_transaction(interceptor);
+  g_commit_ns.fetch_add(now_ns() - start, std::memory_order_relaxed);
+  g_commits.fetch_add(1, std::memory_order_relaxed);
+  g_object_unref(interceptor);
+}
+
+Window::Window(std::string what)
+    : what_(std::move(what)), start_ns_(now_ns()),
+      changes_at_start_(changes()),
+      commits_at_start_(g_commits.load(std::memory_order_relaxed)),
+      commit_ns_at_start_(g_commit_ns.load(std::memory_order_relaxed)) {}
+
+Window::~Window() {
+  int64_t changes_now = changes();
+  WindowStats stats{
+      changes_now < 0 ? -1 : changes_now - changes_at_start_,
+      g_commits.load(std::memory_order_relaxed) - commits_at_start_,
+      static_cast<int64_t>(g_commit_ns.load(std::memory_order_relaxed) -
+                           commit_ns_at_start_) /
+          1000,
+      (now_ns() - start_ns_) / 1000};
+
+  if (stats.changes >= 0) {
+    logger::println("[*] Interceptor {}: {} changes in {} batches, applied "
+                    "in {} us, window {} us",
+                    what_, stats.changes, stats.batches, stats.commit_us,
+                    stats.window_us);
+  } else {
+    logger::println("[*] Interceptor {}: {} batches, applied in {} us, "
+                    "window {} us",
+                    what_, stats.batches, stats.commit_us, stats.window_us);
+  }
+
+  std::lock_guard lock(g_windows_mutex);
+  g_windows[what_] = stats;
+}
+
+std::string toJson() {
+  std::lock_guard lock(g_windows_mutex);
+  std::string json = "{";
+  for (const auto &[what, stats] : g_windows) {
+    json += fmt::format("{}\"{}\":{{\"changes\":{},\"batches\":{},"
+                        "\"commit_us\":{},\"window_us\":{}}}",
+                        json.size() > 1 ? "," : "", what, stats.changes,
+                        stats.batches, stats.commit_us, stats.window_us);
+  }
+  json += "}";
+  return json;
+}
+} // namespace fripack::patching
+
+#ifdef FRIPACK_COUNT_INTERCEPTOR_CHANGES
+// The library is linked with -Wl,--wrap for each of these (see xmake.lua),
+// so calls from GumJS and from this library are counted here first.
+extern "C" {
+GumAttachReturn __real_gum_interceptor_attach(GumInterceptor *self,
+                                              gpointer function_address,
+                                              GumInvocationListener *listener,
+                                              gpointer listener_function_data,
+                                              GumAttachFlags flags);
+void __real_gum_interceptor_detach(GumInterceptor *self,
+                                   GumInvocationListener *listener);
+GumReplaceReturn __real_gum_interceptor_replace(GumInterceptor *self,
+                                                gpointer function_address,
+                                                gpointer replacement_function,
+                                                gpointer replacement_data,
+                                                gpointer *original_function);
+GumReplaceReturn
+__real_gum_interceptor_replace_fast(GumInterceptor *self,
+                                    gpointer function_address,
+                                    gpointer replacement_function,
+                                    gpointer *original_function);
+void __real_gum_interceptor_revert(GumInterceptor *self,
+                                   gpointer function_address);
+
+GumAttachReturn __wrap_gum_interceptor_attach(GumInterceptor *self,
+                                              gpointer function_address,
+                                              GumInvocationListener *listener,
+                                              gpointer listener_function_data,
+                                              GumAttachFlags flags) {
+  fripack::patching::g_changes.fetch_add(1, std::memory_order_relaxed);
+  return __real_gum_interceptor_attach(self, function_address, listener,
+                                       listener_function_data, flags);
+}
+
+void __wrap_gum_interceptor_detach(GumInterceptor *self,
+                                   GumInvocationListener *listener) {
+  fripack::patching::g_changes.fetch_add(1, std::memory_order_relaxed);
+  __real_gum_interceptor_detach(self, listener);
+}
+
+GumReplaceReturn __wrap_gum_interceptor_replace(GumInterceptor *self,
+                                                gpointer function_address,
+                                                gpointer replacement_function,
+                                                gpointer replacement_data,
+                                                gpointer *original_function) {
+  fripack::patching::g_changes.fetch_add(1, std::memory_order_relaxed);
+  return __real_gum_interceptor_replace(self, function_address,
+                                        replacement_function,
+                                        replacement_data, original_function);
+}
+
+GumReplaceReturn
+__wrap_gum_interceptor_replace_fast(GumInterceptor *self,
+                                    gpointer function_address,
+                                    gpointer replacement_function,
+                                    gpointer *original_function) {
+  fripack::patching::g_changes.fetch_add(1, std::memory_order_relaxed);
+  return __real_gum_interceptor_replace_fast(
+      self, function_address, replacement_function, original_function);
+}
+
+void __wrap_gum_interceptor_revert(GumInterceptor *self,
+                                   gpointer function_address) {
+  fripack::patching::g_changes.fetch_add(1, std::memory_order_relaxed);
+  __real_gum_interceptor_revert(self, function_address);
+}
+}
+#endif
+
+// Called like fripack_startup_phases().
+extern "C" EXPORT size_t fripack_patch_stats(char *buffer, size_t size) {
+  return fripack::copyOut(fripack::patching::toJson(), buffer, size);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Interceptor changes (attach, detach, replace, revert) made while scripts
+// load or unload, batched and measured.
+namespace fripack::patching {
+// Holds one Gum interceptor transaction open while alive. Every change made
+// meanwhile, by any thread (including the script's own), is applied in one
+// batch, with one round of code patching and cache flushing, when it ends.
+// Gum must be initialized.
+class Transaction {
+public:
+  Transaction();
+  ~Transaction();
+
+  Transaction(const Transaction &) = delete;
+  Transaction &operator=(const Transaction &) = delete;
+};
+
+// Measures the interceptor changes made while alive and how long they took
+// to apply, and logs them when it goes out of scope. Does not batch
+// anything itself; pair it with a Transaction for that.
+class Window {
+public:
+  explicit Window(std::string what);
+  ~Window();
+
+  Window(const Window &) = delete;
+  Window &operator=(const Window &) = delete;
+
+private:
+  std::string what_;
+  int64_t start_ns_;
+  int64_t changes_at_start_;
+  uint64_t commits_at_start_;
+  uint64_t commit_ns_at_start_;
+};
+
+// {"<what>":{"changes":N,"batches":N,"commit_us":N,"window_us":N},...}
+// with the latest window of each kind. "changes" is -1 where the build
+// cannot count them.
+std::string toJson();
+} // namespace fripack::patching
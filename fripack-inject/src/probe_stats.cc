@@ -0,0 +1,382 @@
+#include "probe_stats.h"
+#include "logger.h"
+
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace fripack::probes {
+namespace {
+struct Counters {
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> total_ns{0};
+  std::array<std::atomic<uint64_t>, kHistogramBuckets> histogram{};
+};
+
+// One per live thread that has recorded a call. Rows are allocated on a
+// thread's first call of a target. When the thread exits its counts are
+// folded into g_retired and the slab, rows included, is zeroed and kept for
+// the next new thread, so memory follows the number of live threads rather
+// than every thread ever seen.
+struct Slab {
+  std::array<std::atomic<Counters *>, kMaxTargets> rows{};
+  Slab *next = nullptr;
+};
+
+// Guards the slab lists and g_retired. Recording only takes it on a
+// thread's first call; snapshot() holds it, so counts being folded are
+// never seen twice or not at all.
+std::mutex g_slabs_mutex;
+Slab *g_slabs = nullptr;
+Slab *g_free_slabs = nullptr;
+Slab g_retired;
+thread_local Slab *t_slab = nullptr;
+
+// Thread exit is observed through a TLS key rather than a thread_local
+// destructor, which would keep dlclose() from unmapping the library.
+#ifdef _WIN32
+DWORD g_exit_key = FLS_OUT_OF_INDEXES;
+#else
+pthread_key_t g_exit_key;
+bool g_exit_key_created = false;
+#endif
+std::mutex g_names_mutex;
+std::vector<std::string> g_names;
+std::atomic<uint32_t> g_target_count{0};
+
+std::atomic<int64_t> g_report_interval_ms{0};
+// Allocated per run and only freed once joined, so no destructor finds the
+// thread joinable at exit().
+struct Reporter {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stop = false;
+  std::thread thread;
+};
+std::mutex g_reporter_mutex;
+Reporter *g_reporter = nullptr;
+std::mutex g_log_mutex;
+std::vector<uint64_t> g_last_logged_calls;
+
+Counters *row_of(Slab *slab, size_t target) {
+  Counters *row = slab->rows[target].load(std::memory_order_relaxed);
+  if (!row) {
+    row = new Counters();
+    slab->rows[target].store(row, std::memory_order_release);
+  }
+  return row;
+}
+
+void free_rows(Slab *slab) {
+  for (auto &row : slab->rows) {
+    delete row.exchange(nullptr, std::memory_order_relaxed);
+  }
+}
+
+#ifdef _WIN32
+void WINAPI on_thread_exit(void *value) {
+#else
+void on_thread_exit(void *value) {
+#endif
+  auto *slab = static_cast<Slab *>(value);
+  if (!slab) {
+    return;
+  }
+  std::lock_guard lock(g_slabs_mutex);
+  for (size_t i = 0; i < kMaxTargets; ++i) {
+    Counters *row = slab->rows[i].load(std::memory_order_relaxed);
+    if (!row) {
+      continue;
+    }
+    Counters *retired = row_of(&g_retired, i);
+    auto fold = [](std::atomic<uint64_t> &from, std::atomic<uint64_t> &to) {
+      to.fetch_add(from.exchange(0, std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+    };
+    fold(row->calls, retired->calls);
+    fold(row->total_ns, retired->total_ns);
+    for (size_t b = 0; b < kHistogramBuckets; ++b) {
+      fold(row->histogram[b], retired->histogram[b]);
+    }
+  }
+  for (Slab **link = &g_slabs; *link; link = &(*link)->next) {
+    if (*link == slab) {
+      *link = slab->next;
+      break;
+    }
+  }
+  slab->next = g_free_slabs;
+  g_free_slabs = slab;
+  // The thread may record again from a later TLS destructor.
+  t_slab = nullptr;
+}
+
+// Caller holds g_slabs_mutex.
+bool watch_thread_exit(Slab *slab) {
+#ifdef _WIN32
+  if (g_exit_key == FLS_OUT_OF_INDEXES) {
+    g_exit_key = FlsAlloc(on_thread_exit);
+  }
+  return g_exit_key != FLS_OUT_OF_INDEXES && FlsSetValue(g_exit_key, slab);
+#else
+  if (!g_exit_key_created) {
+    g_exit_key_created = pthread_key_create(&g_exit_key, on_thread_exit) == 0;
+  }
+  return g_exit_key_created && pthread_setspecific(g_exit_key, slab) == 0;
+#endif
+}
+
+Slab *thread_slab() {
+  if (!t_slab) {
+    std::lock_guard lock(g_slabs_mutex);
+    Slab *slab = g_free_slabs;
+    if (slab) {
+      g_free_slabs = slab->next;
+    } else {
+      slab = new Slab();
+    }
+    if (!watch_thread_exit(slab)) {
+      logger::warn("Cannot watch thread exit, probe counters will leak");
+    }
+    slab->next = g_slabs;
+    g_slabs = slab;
+    t_slab = slab;
+  }
+  return t_slab;
+}
+
+// Only the owning thread writes a row, so a plain load and store is enough
+// to keep readers from seeing torn values.
+void bump(std::atomic<uint64_t> &counter, uint64_t by) {
+  counter.store(counter.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+}
+} // namespace
+
+uint32_t registerTarget(const std::string &name) {
+  std::lock_guard lock(g_names_mutex);
+  for (uint32_t i = 0; i < g_names.size(); ++i) {
+    if (g_names[i] == name) {
+      return i;
+    }
+  }
+  if (g_names.size() >= kMaxTargets) {
+    logger::warn("Too many profiled targets, ignoring {}", name);
+    return kInvalidTarget;
+  }
+  g_names.push_back(name);
+  g_target_count.store(g_names.size(), std::memory_order_release);
+  return g_names.size() - 1;
+}
+
+void record(uint32_t target, uint64_t duration_ns) {
+  if (target >= kMaxTargets) {
+    return;
+  }
+  Counters *row = row_of(thread_slab(), target);
+  size_t bucket =
+      duration_ns == 0 ? 0 : std::bit_width(duration_ns) - 1;
+  bump(row->calls, 1);
+  bump(row->total_ns, duration_ns);
+  bump(row->histogram[std::min(bucket, kHistogramBuckets - 1)], 1);
+}
+
+uint64_t Summary::percentileNs(double quantile) const {
+  if (calls == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(quantile * (calls - 1)) + 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kHistogramBuckets; ++i) {
+    seen += histogram[i];
+    if (seen >= rank) {
+      return (uint64_t{1} << (i + 1)) - 1;
+    }
+  }
+  return UINT64_MAX;
+}
+
+std::vector<Summary> snapshot() {
+  std::vector<Summary> summaries;
+  {
+    std::lock_guard lock(g_names_mutex);
+    summaries.resize(g_names.size());
+    for (size_t i = 0; i < g_names.size(); ++i) {
+      summaries[i].name = g_names[i];
+    }
+  }
+
+  std::lock_guard lock(g_slabs_mutex);
+  auto add = [&](const Slab *slab) {
+    for (size_t i = 0; i < summaries.size(); ++i) {
+      Counters *row = slab->rows[i].load(std::memory_order_acquire);
+      if (!row) {
+        continue;
+      }
+      summaries[i].calls += row->calls.load(std::memory_order_relaxed);
+      summaries[i].total_ns += row->total_ns.load(std::memory_order_relaxed);
+      for (size_t b = 0; b < kHistogramBuckets; ++b) {
+        summaries[i].histogram[b] +=
+            row->histogram[b].load(std::memory_order_relaxed);
+      }
+    }
+  };
+  add(&g_retired);
+  for (const Slab *slab = g_slabs; slab; slab = slab->next) {
+    add(slab);
+  }
+  return summaries;
+}
+
+std::string escapeName(std::string_view name) {
+  std::string escaped;
+  for (char c : name) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+    }
+    escaped.push_back(static_cast<unsigned char>(c) < 0x20 ? ' ' : c);
+  }
+  return escaped;
+}
+
+std::string toJson(const std::vector<Summary> &summaries) {
+  std::string json = "[";
+  for (const auto &summary : summaries) {
+    if (json.size() > 1) {
+      json += ",";
+    }
+    std::string histogram;
+    for (size_t b = 0; b < kHistogramBuckets; ++b) {
+      if (summary.histogram[b] != 0) {
+        histogram += fmt::format("{}[{},{}]", histogram.empty() ? "" : ",", b,
+                                 summary.histogram[b]);
+      }
+    }
+    json += fmt::format(
+        "{{\"name\":\"{}\",\"calls\":{},\"total_ns\":{},\"p50_ns\":{},"
+        "\"p90_ns\":{},\"p99_ns\":{},\"histogram\":[{}]}}",
+        escapeName(summary.name), summary.calls, summary.total_ns,
+        summary.percentileNs(0.5), summary.percentileNs(0.9),
+        summary.percentileNs(0.99), histogram);
+  }
+  json += "]";
+  return json;
+}
+
+void logSummary() {
+  std::lock_guard lock(g_log_mutex);
+  auto summaries = snapshot();
+  g_last_logged_calls.resize(summaries.size());
+  for (size_t i = 0; i < summaries.size(); ++i) {
+    const auto &summary = summaries[i];
+    if (summary.calls == g_last_logged_calls[i]) {
+      continue;
+    }
+    logger::println("[*] Probe {}: {} calls (+{}), mean {} ns, p50 <= {} ns, "
+                    "p99 <= {} ns",
+                    summary.name, summary.calls,
+                    summary.calls - g_last_logged_calls[i],
+                    summary.total_ns / summary.calls,
+                    summary.percentileNs(0.5), summary.percentileNs(0.99));
+    g_last_logged_calls[i] = summary.calls;
+  }
+}
+
+void startReporter(std::chrono::milliseconds interval) {
+  int64_t requested = interval.count();
+  if (requested <= 0) {
+    return;
+  }
+  int64_t current = g_report_interval_ms.load();
+  while (current == 0 || requested < current) {
+    if (g_report_interval_ms.compare_exchange_weak(current, requested)) {
+      break;
+    }
+  }
+  if (current != 0) {
+    return;
+  }
+
+  std::lock_guard lock(g_reporter_mutex);
+  auto *reporter = new Reporter();
+  reporter->thread = std::thread([reporter]() {
+    std::unique_lock lock(reporter->mutex);
+    while (!reporter->cv.wait_for(
+        lock, std::chrono::milliseconds(g_report_interval_ms.load()),
+        [reporter]() { return reporter->stop; })) {
+      lock.unlock();
+      logSummary();
+      lock.lock();
+    }
+  });
+  g_reporter = reporter;
+}
+
+void stopReporter() {
+  Reporter *reporter;
+  {
+    std::lock_guard lock(g_reporter_mutex);
+    reporter = std::exchange(g_reporter, nullptr);
+  }
+  if (!reporter) {
+    return;
+  }
+  {
+    std::lock_guard lock(reporter->mutex);
+    reporter->stop = true;
+  }
+  reporter->cv.notify_all();
+  reporter->thread.join();
+  delete reporter;
+  g_report_interval_ms = 0;
+  logSummary();
+}
+
+void releaseAll() {
+  // Windows runs the exit callback of every thread here, so before the
+  // lock is taken.
+#ifdef _WIN32
+  if (g_exit_key != FLS_OUT_OF_INDEXES) {
+    FlsFree(g_exit_key);
+    g_exit_key = FLS_OUT_OF_INDEXES;
+  }
+#else
+  if (g_exit_key_created) {
+    pthread_key_delete(g_exit_key);
+    g_exit_key_created = false;
+  }
+#endif
+
+  {
+    std::lock_guard lock(g_slabs_mutex);
+    for (Slab *list : {g_slabs, g_free_slabs}) {
+      while (list) {
+        Slab *next = list->next;
+        free_rows(list);
+        delete list;
+        list = next;
+      }
+    }
+    g_slabs = nullptr;
+    g_free_slabs = nullptr;
+    free_rows(&g_retired);
+    t_slab = nullptr;
+  }
+  {
+    std::lock_guard lock(g_names_mutex);
+    g_names.clear();
+    g_target_count.store(0, std::memory_order_release);
+  }
+  std::lock_guard lock(g_log_mutex);
+  g_last_logged_calls.clear();
+}
+} // namespace fripack::probes
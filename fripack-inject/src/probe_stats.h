@@ -0,0 +1,64 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fripack::probes {
+inline constexpr uint32_t kMaxTargets = 512;
+inline constexpr uint32_t kInvalidTarget = UINT32_MAX;
+// Bucket i counts durations in [2^i, 2^(i+1)) ns; bucket 0 also takes 0 ns.
+inline constexpr size_t kHistogramBuckets = 40;
+
+// Returns an id for record(), or kInvalidTarget once kMaxTargets names
+// are registered. Registering the same name again returns the same id.
+uint32_t registerTarget(const std::string &name);
+
+// Counts one call of the target. Lock-free and wait-free: each thread writes
+// only its own counters, which snapshot() sums up.
+void record(uint32_t target, uint64_t duration_ns);
+
+inline uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Summary {
+  std::string name;
+  uint64_t calls = 0;
+  uint64_t total_ns = 0;
+  std::array<uint64_t, kHistogramBuckets> histogram{};
+
+  // Upper bound of the bucket holding the given quantile (0..1).
+  uint64_t percentileNs(double quantile) const;
+};
+
+// Totals per registered target, merged across threads.
+std::vector<Summary> snapshot();
+
+// Names come from the config or from scripts; this keeps them valid inside
+// a JSON string.
+std::string escapeName(std::string_view name);
+
+// [{"name":...,"calls":...,"total_ns":...,"p50_ns":...,"p90_ns":...,
+//   "p99_ns":...,"histogram":[[<bucket>,<count>],...]},...]
+std::string toJson(const std::vector<Summary> &summaries);
+
+// Logs one line per target that was called since the previous log.
+void logSummary();
+
+// Starts a background thread calling logSummary() every interval. Later
+// calls only shorten the interval.
+void startReporter(std::chrono::milliseconds interval);
+
+// Stops and joins the reporter, logging the totals one last time. A later
+// startReporter() starts a new one.
+void stopReporter();
+
+// Frees every thread's counters and forgets the targets, for unload. No
+// hook may record any more, and the reporter must be stopped.
+void releaseAll();
+} // namespace fripack::probes
@@ -0,0 +1,215 @@
+#include "probes.h"
+#include "export.h"
+#include "logger.h"
+#include "probe_stats.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+
+#include "frida-gumjs.h"
+
+namespace fripack::probes {
+namespace {
+constexpr uint32_t kMaxSampleArgs = 8;
+constexpr uint32_t kSampleCalls = 16;
+
+struct Probe {
+  uint32_t id;
+  uint32_t sample_args;
+  GumInvocationListener *listener = nullptr;
+  // Claimed with fetch_add until kSampleCalls calls have been sampled;
+  // after that a relaxed load is all the hot path pays.
+  std::atomic<uint32_t> samples_claimed{0};
+  std::array<std::atomic<uint32_t>, kSampleCalls> sample_ready{};
+  std::array<std::array<uint64_t, kMaxSampleArgs>, kSampleCalls> samples{};
+};
+
+// Probes must outlive their listeners. uninstall() detaches the listeners
+// but keeps the probes, since a call that entered before the detach still
+// leaves through on_leave.
+std::mutex g_probes_mutex;
+std::deque<Probe> g_probes;
+
+void on_enter(GumInvocationContext *context, gpointer user_data) {
+  auto *probe = static_cast<Probe *>(user_data);
+  if (probe->sample_args != 0 &&
+      probe->samples_claimed.load(std::memory_order_relaxed) < kSampleCalls) {
+    uint32_t slot =
+        probe->samples_claimed.fetch_add(1, std::memory_order_relaxed);
+    if (slot < kSampleCalls) {
+      for (uint32_t i = 0; i < probe->sample_args; ++i) {
+        probe->samples[slot][i] = reinterpret_cast<uintptr_t>(
+            gum_invocation_context_get_nth_argument(context, i));
+      }
+      probe->sample_ready[slot].store(1, std::memory_order_release);
+    }
+  }
+  *GUM_IC_GET_INVOCATION_DATA(context, uint64_t *) = nowNs();
+}
+
+void on_leave(GumInvocationContext *context, gpointer user_data) {
+  auto *probe = static_cast<Probe *>(user_data);
+  record(probe->id, nowNs() - *GUM_IC_GET_INVOCATION_DATA(context, uint64_t *));
+}
+
+GumAddress resolve(const config::ProbeTarget &target) {
+  GumModule *module = nullptr;
+  if (target.module) {
+    module = gum_process_find_module_by_name(target.module->c_str());
+    if (!module) {
+      logger::warn("Probe module {} is not loaded", *target.module);
+      return 0;
+    }
+  }
+
+  GumAddress address = 0;
+  if (target.symbol) {
+    if (module) {
+      address = gum_module_find_export_by_name(module, target.symbol->c_str());
+      if (!address) {
+        address =
+            gum_module_find_symbol_by_name(module, target.symbol->c_str());
+      }
+    } else {
+      address = gum_module_find_global_export_by_name(target.symbol->c_str());
+    }
+  } else if (target.address) {
+    address = std::strtoull(target.address->c_str(), nullptr, 16);
+    if (module && address) {
+      address += gum_module_get_range(module)->base_address;
+    }
+  }
+
+  if (module) {
+    g_object_unref(module);
+  }
+  return address;
+}
+
+std::string target_name(const config::ProbeTarget &target) {
+  if (target.name) {
+    return *target.name;
+  }
+  std::string where = target.symbol ? *target.symbol
+                                    : target.address.value_or("?");
+  return target.module ? *target.module + "!" + where : where;
+}
+} // namespace
+
+void install(const config::ProbesConfig &probes) {
+  GumInterceptor *interceptor = gum_interceptor_obtain();
+  gum_interceptor_begin_transaction(interceptor);
+
+  size_t attached = 0;
+  for (const auto &target : probes.targets) {
+    std::string name = target_name(target);
+    GumAddress address = resolve(target);
+    if (!address) {
+      logger::warn("Probe {} did not resolve, skipping", name);
+      continue;
+    }
+    uint32_t id = registerTarget(name);
+    if (id == kInvalidTarget) {
+      continue;
+    }
+
+    Probe *probe;
+    {
+      std::lock_guard lock(g_probes_mutex);
+      probe = &g_probes.emplace_back();
+    }
+    probe->id = id;
+    probe->sample_args = std::min(target.sample_args.value_or(0),
+                                  kMaxSampleArgs);
+
+    GumInvocationListener *listener =
+        gum_make_call_listener(on_enter, on_leave, probe, nullptr);
+    GumAttachReturn result = gum_interceptor_attach(
+        interceptor, GSIZE_TO_POINTER(address), listener, nullptr,
+        GUM_ATTACH_FLAGS_NONE);
+    if (result != GUM_ATTACH_OK) {
+      logger::warn("Failed to attach probe {} at {:#x}: {}", name, address,
+                   static_cast<int>(result));
+      g_object_unref(listener);
+      continue;
+    }
+    probe->listener = listener;
+    ++attached;
+    logger::debug("Probe {} attached at {:#x}", name, address);
+  }
+
+  gum_interceptor_end_transaction(interceptor);
+  g_object_unref(interceptor);
+
+  logger::println("[*] Attached {} of {} native probes", attached,
+                  probes.targets.size());
+  if (attached != 0) {
+    startReporter(
+        std::chrono::milliseconds(probes.report_interval_ms.value_or(10000)));
+  }
+}
+
+void uninstall() {
+  std::lock_guard lock(g_probes_mutex);
+  GumInterceptor *interceptor = gum_interceptor_obtain();
+  gum_interceptor_begin_transaction(interceptor);
+  size_t detached = 0;
+  for (auto &probe : g_probes) {
+    if (probe.listener) {
+      gum_interceptor_detach(interceptor, probe.listener);
+      g_object_unref(probe.listener);
+      probe.listener = nullptr;
+      ++detached;
+    }
+  }
+  gum_interceptor_end_transaction(interceptor);
+  g_object_unref(interceptor);
+
+  if (detached != 0) {
+    logger::println("[*] Detached {} native probes", detached);
+  }
+}
+
+namespace {
+std::string samples_json() {
+  std::string json = "{";
+  std::lock_guard lock(g_probes_mutex);
+  auto summaries = snapshot();
+  for (const auto &probe : g_probes) {
+    if (probe.sample_args == 0 || probe.id >= summaries.size()) {
+      continue;
+    }
+    std::string calls;
+    for (uint32_t slot = 0; slot < kSampleCalls; ++slot) {
+      if (!probe.sample_ready[slot].load(std::memory_order_acquire)) {
+        continue;
+      }
+      std::string args;
+      for (uint32_t i = 0; i < probe.sample_args; ++i) {
+        args += fmt::format("{}\"{:#x}\"", i ? "," : "",
+                            probe.samples[slot][i]);
+      }
+      calls += fmt::format("{}[{}]", calls.empty() ? "" : ",", args);
+    }
+    json += fmt::format("{}\"{}\":[{}]", json.size() > 1 ? "," : "",
+                        escapeName(summaries[probe.id].name), calls);
+  }
+  json += "}";
+  return json;
+}
+} // namespace
+} // namespace fripack::probes
+
+// {"targets":[<probe_stats::toJson entries>],"samples":{"<name>":[[args]]}}
+// Called like fripack_startup_phases().
+extern "C" EXPORT size_t fripack_probe_stats(char *buffer, size_t size) {
+  return fripack::copyOut(
+      fmt::format("{{\"targets\":{},\"samples\":{}}}",
+                  fripack::probes::toJson(fripack::probes::snapshot()),
+                  fripack::probes::samples_json()),
+      buffer, size);
+}
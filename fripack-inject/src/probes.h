@@ -0,0 +1,13 @@
+#pragma once
+#include "config.h"
+
+namespace fripack::probes {
+// Attaches a native listener to every target that resolves, in a single
+// interceptor transaction. Gum must be initialized. Targets that fail to
+// resolve or attach are logged and skipped.
+void install(const config::ProbesConfig &probes);
+
+// Detaches every listener install() attached. Gum must still be
+// initialized.
+void uninstall();
+} // namespace fripack::probes
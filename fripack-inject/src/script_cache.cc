@@ -0,0 +1,136 @@
+#include "script_cache.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <system_error>
+#include <vector>
+
+namespace fripack {
+
+namespace {
+constexpr const char *kEntryExtension = ".qjsc";
+
+// Bytecode is only valid for the QuickJS build it came from, which is the
+// one in the Frida devkit this library was built against. Builds that do
+// not name the version share one key; stale entries that slip through are
+// rejected at load time and invalidated by the caller.
+#ifdef FRIPACK_FRIDA_VERSION
+constexpr const char *kBackendTag = "qjs:frida-" FRIPACK_FRIDA_VERSION;
+#else
+constexpr const char *kBackendTag = "qjs:frida-unknown";
+#endif
+} // namespace
+
+ScriptCache::ScriptCache(std::filesystem::path dir, uint64_t max_bytes)
+    : dir_(std::move(dir)), max_bytes_(max_bytes) {
+  std::error_code ec;
+  std::filesystem::create_directories(dir_, ec);
+  if (ec) {
+    logger::error("Failed to create script cache dir {}: {}", dir_.string(),
+                  ec.message());
+  }
+}
+
+std::filesystem::path ScriptCache::entry_path(std::string_view source) const {
+  std::string keyed(kBackendTag);
+  keyed.push_back('\0');
+  keyed.append(source);
+
+  gchar *digest = g_compute_checksum_for_data(
+      G_CHECKSUM_SHA256, reinterpret_cast<const guchar *>(keyed.data()),
+      keyed.size());
+  auto path = dir_ / (std::string(digest) + kEntryExtension);
+  g_free(digest);
+  return path;
+}
+
+GBytes *ScriptCache::lookup(std::string_view source) const {
+  auto path = entry_path(source);
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return nullptr;
+  }
+
+  auto size = static_cast<gsize>(file.tellg());
+  file.seekg(0);
+  auto *buffer = static_cast<gchar *>(g_malloc(size));
+  if (!file.read(buffer, size)) {
+    g_free(buffer);
+    return nullptr;
+  }
+
+  std::error_code ec;
+  std::filesystem::last_write_time(
+      path, std::filesystem::file_time_type::clock::now(), ec);
+
+  logger::println("[*] Script cache hit: {}", path.filename().string());
+  return g_bytes_new_take(buffer, size);
+}
+
+void ScriptCache::store(std::string_view source, GBytes *bytecode) {
+  auto path = entry_path(source);
+
+  // Written in full to a temporary file of its own and renamed into place,
+  // so processes sharing the directory never see a torn entry.
+  gsize size = 0;
+  auto *data = static_cast<const gchar *>(g_bytes_get_data(bytecode, &size));
+  GError *error = nullptr;
+  if (!g_file_set_contents(path.string().c_str(), data, size, &error)) {
+    logger::error("Failed to write script cache entry {}: {}", path.string(),
+                  error->message);
+    g_error_free(error);
+    return;
+  }
+
+  evict();
+}
+
+void ScriptCache::invalidate(std::string_view source) {
+  std::error_code ec;
+  std::filesystem::remove(entry_path(source), ec);
+}
+
+void ScriptCache::evict() {
+  struct Entry {
+    std::filesystem::path path;
+    std::filesystem::file_time_type mtime;
+    uint64_t size;
+  };
+
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (const auto &it : std::filesystem::directory_iterator(dir_, ec)) {
+    if (it.path().extension() != kEntryExtension) {
+      continue;
+    }
+    std::error_code entry_ec;
+    Entry entry{it.path(), it.last_write_time(entry_ec),
+                it.file_size(entry_ec)};
+    if (entry_ec) {
+      continue;
+    }
+    total += entry.size;
+    entries.push_back(std::move(entry));
+  }
+
+  if (total <= max_bytes_) {
+    return;
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.mtime < b.mtime; });
+  for (const auto &entry : entries) {
+    if (total <= max_bytes_) {
+      break;
+    }
+    if (std::filesystem::remove(entry.path, ec)) {
+      total -= entry.size;
+      logger::println("[*] Evicted script cache entry {}",
+                      entry.path.filename().string());
+    }
+  }
+}
+
+} // namespace fripack
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include "frida-gumjs.h"
+
+namespace fripack {
+// On-disk cache of compiled script bytecode, keyed by a hash of the source
+// and the backend that compiled it. Entries are evicted least recently used
+// first once the directory grows past max_bytes.
+class ScriptCache {
+public:
+  ScriptCache(std::filesystem::path dir, uint64_t max_bytes);
+
+  // Returns a new reference to the cached bytecode, or nullptr on a miss.
+  GBytes *lookup(std::string_view source) const;
+  void store(std::string_view source, GBytes *bytecode);
+  void invalidate(std::string_view source);
+
+private:
+  std::filesystem::path entry_path(std::string_view source) const;
+  void evict();
+
+  std::filesystem::path dir_;
+  uint64_t max_bytes_;
+};
+} // namespace fripack
@@ -0,0 +1,114 @@
+#include "script_selector.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "frida-gumjs.h"
+
+namespace fripack::config {
+
+namespace {
+constexpr const char *kArch =
+#if defined(__aarch64__) || defined(_M_ARM64)
+    "arm64";
+#elif defined(__arm__) || defined(_M_ARM)
+    "arm";
+#elif defined(__x86_64__) || defined(_M_X64)
+    "x86_64";
+#elif defined(__i386__) || defined(_M_IX86)
+    "x86";
+#else
+    "unknown";
+#endif
+
+// Android app processes carry their package (and ":service" suffix) as
+// argv[0]; everything else gets matched on the executable path.
+std::string process_name() {
+#ifdef _WIN32
+  char path[MAX_PATH];
+  DWORD len = GetModuleFileNameA(nullptr, path, MAX_PATH);
+  return std::string(path, len);
+#else
+  std::ifstream cmdline("/proc/self/cmdline", std::ios::binary);
+  std::string argv0;
+  std::getline(cmdline, argv0, '\0');
+  return argv0;
+#endif
+}
+
+std::string base_name(const std::string &path) {
+  auto pos = path.find_last_of("/\\");
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+bool any_matches(const std::vector<std::string> &patterns,
+                 const std::vector<std::string> &candidates) {
+  for (const auto &pattern : patterns) {
+    for (const auto &candidate : candidates) {
+      if (g_pattern_match_simple(pattern.c_str(), candidate.c_str())) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+std::vector<std::string> loaded_modules() {
+  std::vector<std::string> names;
+  gum_process_enumerate_modules(
+      [](GumModule *module, gpointer user_data) -> gboolean {
+        static_cast<std::vector<std::string> *>(user_data)->emplace_back(
+            gum_module_get_name(module));
+        return TRUE;
+      },
+      &names);
+  return names;
+}
+} // namespace
+
+std::vector<const ScriptEntry *>
+selectScripts(const std::vector<ScriptEntry> &entries) {
+  std::string process = process_name();
+  std::vector<std::string> process_names{process, base_name(process)};
+  std::optional<std::vector<std::string>> modules;
+
+  std::vector<const ScriptEntry *> selected;
+  for (const auto &entry : entries) {
+    if (entry.match) {
+      const auto &match = *entry.match;
+      if (match.arch && !any_matches(*match.arch, {kArch})) {
+        continue;
+      }
+      if (match.process && !any_matches(*match.process, process_names)) {
+        continue;
+      }
+      if (match.module) {
+        if (!modules) {
+          modules = loaded_modules();
+        }
+        if (!any_matches(*match.module, *modules)) {
+          continue;
+        }
+      }
+    }
+    selected.push_back(&entry);
+  }
+
+  std::stable_sort(selected.begin(), selected.end(),
+                   [](const ScriptEntry *a, const ScriptEntry *b) {
+                     return a->order.value_or(0) < b->order.value_or(0);
+                   });
+
+  logger::println("[*] Selected {} of {} scripts for {}", selected.size(),
+                  entries.size(), process);
+  return selected;
+}
+
+} // namespace fripack::config
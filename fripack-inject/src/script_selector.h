@@ -0,0 +1,12 @@
+#pragma once
+#include <vector>
+
+#include "config.h"
+
+namespace fripack::config {
+// Returns the entries whose match rules hold in this process, in load
+// order. Module rules look at what is loaded right now, so Gum must be
+// initialized first.
+std::vector<const ScriptEntry *>
+selectScripts(const std::vector<ScriptEntry> &entries);
+} // namespace fripack::config
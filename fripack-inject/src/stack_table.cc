@@ -0,0 +1,368 @@
+#include "stack_table.h"
+#include "export.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__linux__) || defined(__ANDROID__)
+#include <pthread.h>
+#endif
+
+#include "frida-gumjs.h"
+
+namespace fripack::stacks {
+namespace {
+constexpr size_t kTableSize = 4096; // Power of two.
+constexpr size_t kMaxProbes = 64;
+// Frames further apart than this end the walk; no sane frame is that big.
+constexpr uintptr_t kMaxFrameSize = 1024 * 1024;
+
+enum State : uint32_t {
+  Empty = 0,
+  Ready = 1,
+  Symbolized = 2,
+};
+
+// hash doubles as the claim: a slot is taken by the thread that swaps it
+// from 0. Frames are published by the release store of state.
+struct Entry {
+  std::atomic<uint64_t> hash{0};
+  std::atomic<uint32_t> state{Empty};
+  uint32_t depth = 0;
+  std::atomic<uint64_t> count{0};
+  std::array<uintptr_t, kMaxFrames> frames{};
+};
+
+Entry g_table[kTableSize];
+std::atomic<uint64_t> g_dropped{0};
+// Bumped for every new stack; the symbolizer sleeps on it.
+std::atomic<uint32_t> g_generation{0};
+
+// g_symbolizer_state is read on every capture; the mutex only serializes
+// starting and stopping.
+enum SymbolizerState : uint32_t {
+  NotStarted = 0,
+  Running = 1,
+  Stopped = 2,
+};
+std::atomic<uint32_t> g_symbolizer_state{NotStarted};
+std::mutex g_symbolizer_mutex;
+// A pointer, so no destructor finds it joinable at exit().
+std::thread *g_symbolizer = nullptr;
+
+struct ModuleRange {
+  uintptr_t start;
+  uintptr_t end;
+  std::string name;
+};
+
+// Guards everything below; only taken off the capture path.
+std::mutex g_symbol_mutex;
+std::vector<ModuleRange> g_modules;
+std::unordered_map<uintptr_t, std::string> g_symbols;
+std::vector<std::vector<std::string>> g_symbolized(kTableSize);
+
+uint64_t hash_frames(const uintptr_t *frames, size_t depth) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < depth; ++i) {
+    hash = (hash ^ frames[i]) * 0x100000001b3ull;
+    hash ^= hash >> 29;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+size_t walk(uintptr_t pc, uintptr_t fp, uintptr_t stack_low,
+            uintptr_t stack_high, uintptr_t *out) {
+  size_t depth = 0;
+  if (pc) {
+    out[depth++] = pc;
+  }
+#if defined(__aarch64__) || defined(__x86_64__) || defined(__i386__) ||   \
+    defined(__arm__)
+  // Frame records on these are {previous fp, return address}. On 32-bit ARM
+  // that is the layout clang emits (fp is r7 in Thumb code, r11 in ARM
+  // code); GCC's APCS frames end the walk early.
+  while (depth < kMaxFrames && fp != 0 && fp % sizeof(uintptr_t) == 0) {
+    if (stack_high != 0 &&
+        (fp < stack_low || fp + 2 * sizeof(uintptr_t) > stack_high)) {
+      break;
+    }
+    auto *record = reinterpret_cast<const uintptr_t *>(fp);
+    uintptr_t next_fp = record[0];
+    uintptr_t return_address = record[1];
+    if (return_address == 0) {
+      break;
+    }
+#if defined(__aarch64__)
+    return_address &= 0x00ffffffffffffffull; // Drop PAC/tag bits.
+#elif defined(__arm__)
+    return_address &= ~uintptr_t{1}; // Drop the Thumb bit.
+#endif
+    out[depth++] = return_address;
+    if (next_fp <= fp || next_fp - fp > kMaxFrameSize) {
+      break;
+    }
+    fp = next_fp;
+  }
+#endif
+  return depth;
+}
+
+void refresh_modules() {
+  g_modules.clear();
+  gum_process_enumerate_modules(
+      [](GumModule *module, gpointer) -> gboolean {
+        const GumMemoryRange *range = gum_module_get_range(module);
+        g_modules.push_back({static_cast<uintptr_t>(range->base_address),
+                             static_cast<uintptr_t>(range->base_address +
+                                                    range->size),
+                             gum_module_get_name(module)});
+        return TRUE;
+      },
+      nullptr);
+  std::sort(g_modules.begin(), g_modules.end(),
+            [](const auto &a, const auto &b) { return a.start < b.start; });
+}
+
+const ModuleRange *find_module(uintptr_t address) {
+  auto it = std::upper_bound(
+      g_modules.begin(), g_modules.end(), address,
+      [](uintptr_t value, const auto &range) { return value < range.start; });
+  if (it == g_modules.begin()) {
+    return nullptr;
+  }
+  --it;
+  return address < it->end ? &*it : nullptr;
+}
+
+// Caller holds g_symbol_mutex.
+const std::string &symbolize_locked(uintptr_t address, bool *refreshed) {
+  auto cached = g_symbols.find(address);
+  if (cached != g_symbols.end()) {
+    return cached->second;
+  }
+
+  const ModuleRange *module = find_module(address);
+  if (!module && !*refreshed) {
+    // Modules loaded since the last refresh; one rescan per batch.
+    refresh_modules();
+    *refreshed = true;
+    module = find_module(address);
+  }
+
+  std::string text;
+  if (module) {
+    text = fmt::format("{}+{:#x}", module->name, address - module->start);
+    GumDebugSymbolDetails details;
+    if (gum_symbol_details_from_address(GSIZE_TO_POINTER(address),
+                                        &details) &&
+        details.symbol_name[0] != '\0') {
+      text += fmt::format(" {}", details.symbol_name);
+    }
+  } else {
+    text = fmt::format("{:#x}", address);
+  }
+  return g_symbols.emplace(address, std::move(text)).first->second;
+}
+
+// Caller holds g_symbol_mutex.
+void symbolize_pending_locked() {
+  bool refreshed = false;
+  for (size_t i = 0; i < kTableSize; ++i) {
+    Entry &entry = g_table[i];
+    if (entry.state.load(std::memory_order_acquire) != Ready) {
+      continue;
+    }
+    auto &out = g_symbolized[i];
+    out.clear();
+    for (size_t f = 0; f < entry.depth; ++f) {
+      out.push_back(symbolize_locked(entry.frames[f], &refreshed));
+    }
+    entry.state.store(Symbolized, std::memory_order_relaxed);
+  }
+}
+} // namespace
+
+int32_t capture(uintptr_t pc, uintptr_t fp, uintptr_t stack_low,
+                uintptr_t stack_high) {
+  uintptr_t frames[kMaxFrames];
+  if (fp == 0) {
+    fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  }
+  size_t depth = walk(pc, fp, stack_low, stack_high, frames);
+  uint64_t hash = hash_frames(frames, depth);
+
+  for (size_t probe = 0; probe < kMaxProbes; ++probe) {
+    size_t index = (hash + probe) & (kTableSize - 1);
+    Entry &entry = g_table[index];
+    uint64_t current = entry.hash.load(std::memory_order_acquire);
+    if (current == 0) {
+      if (entry.hash.compare_exchange_strong(current, hash,
+                                             std::memory_order_acq_rel)) {
+        std::copy(frames, frames + depth, entry.frames.begin());
+        entry.depth = static_cast<uint32_t>(depth);
+        entry.count.fetch_add(1, std::memory_order_relaxed);
+        entry.state.store(Ready, std::memory_order_release);
+        g_generation.fetch_add(1, std::memory_order_release);
+        g_generation.notify_one();
+        return static_cast<int32_t>(index);
+      }
+    }
+    if (current == hash) {
+      entry.count.fetch_add(1, std::memory_order_relaxed);
+      return static_cast<int32_t>(index);
+    }
+  }
+  g_dropped.fetch_add(1, std::memory_order_relaxed);
+  return kNoStack;
+}
+
+std::vector<std::string> symbolize(const uintptr_t *frames, size_t count) {
+  std::lock_guard lock(g_symbol_mutex);
+  bool refreshed = false;
+  std::vector<std::string> out;
+  out.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    out.push_back(symbolize_locked(frames[i], &refreshed));
+  }
+  return out;
+}
+
+std::vector<std::string> frames(int32_t id) {
+  if (id < 0 || static_cast<size_t>(id) >= kTableSize) {
+    return {};
+  }
+  std::lock_guard lock(g_symbol_mutex);
+  symbolize_pending_locked();
+  return g_symbolized[id];
+}
+
+std::string toJson() {
+  std::lock_guard lock(g_symbol_mutex);
+  symbolize_pending_locked();
+
+  std::vector<std::pair<uint64_t, size_t>> by_count;
+  for (size_t i = 0; i < kTableSize; ++i) {
+    if (g_table[i].state.load(std::memory_order_acquire) == Symbolized) {
+      by_count.emplace_back(g_table[i].count.load(std::memory_order_relaxed),
+                            i);
+    }
+  }
+  std::sort(by_count.rbegin(), by_count.rend());
+
+  std::string json = fmt::format("{{\"dropped\":{},\"stacks\":[",
+                                 g_dropped.load(std::memory_order_relaxed));
+  for (size_t n = 0; n < by_count.size(); ++n) {
+    auto [count, index] = by_count[n];
+    std::string frames;
+    for (const auto &frame : g_symbolized[index]) {
+      std::string escaped;
+      for (char c : frame) {
+        if (c == '"' || c == '\\') {
+          escaped.push_back('\\');
+        }
+        escaped.push_back(c);
+      }
+      frames += fmt::format("{}\"{}\"", frames.empty() ? "" : ",", escaped);
+    }
+    json += fmt::format("{}{{\"id\":{},\"count\":{},\"frames\":[{}]}}",
+                        n ? "," : "", index, count, frames);
+  }
+  json += "]}";
+  return json;
+}
+
+void startSymbolizer() {
+  if (g_symbolizer_state.load(std::memory_order_acquire) != NotStarted) {
+    return;
+  }
+  std::lock_guard lock(g_symbolizer_mutex);
+  if (g_symbolizer_state.load(std::memory_order_relaxed) != NotStarted) {
+    return;
+  }
+  g_symbolizer_state.store(Running, std::memory_order_release);
+  g_symbolizer = new std::thread([]() {
+    uint32_t seen = 0;
+    while (g_symbolizer_state.load(std::memory_order_acquire) == Running) {
+      g_generation.wait(seen, std::memory_order_acquire);
+      seen = g_generation.load(std::memory_order_acquire);
+      std::lock_guard lock(g_symbol_mutex);
+      symbolize_pending_locked();
+    }
+  });
+}
+
+void stopSymbolizer() {
+  std::lock_guard lock(g_symbolizer_mutex);
+  g_symbolizer_state.store(Stopped, std::memory_order_release);
+  if (g_symbolizer) {
+    g_generation.fetch_add(1, std::memory_order_release);
+    g_generation.notify_all();
+    g_symbolizer->join();
+    delete g_symbolizer;
+    g_symbolizer = nullptr;
+  }
+}
+} // namespace fripack::stacks
+
+namespace {
+// Stack bounds of the calling thread, looked up once per thread so the
+// walk never leaves the stack. The lookup allocates, and on the main thread
+// reads /proc/self/maps, so it is not async-signal-safe.
+struct StackBounds {
+  uintptr_t low = 0;
+  uintptr_t high = 0;
+};
+
+const StackBounds &thread_stack_bounds() {
+  thread_local StackBounds bounds = []() {
+    StackBounds result;
+#if defined(__linux__) || defined(__ANDROID__)
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+      void *address;
+      size_t size;
+      if (pthread_attr_getstack(&attr, &address, &size) == 0) {
+        result.low = reinterpret_cast<uintptr_t>(address);
+        result.high = result.low + size;
+      }
+      pthread_attr_destroy(&attr);
+    }
+#endif
+    return result;
+  }();
+  return bounds;
+}
+} // namespace
+
+extern "C" {
+// From a hook: capture(this.returnAddress, this.context.fp) on arm64,
+// this.context.rbp on x86_64, or this.context.r7 in Thumb code on 32-bit
+// ARM. Pass NULL for both to start at the caller. Async-signal-safe once
+// the calling thread has called it before.
+EXPORT int32_t fripack_stack_capture(const void *pc, const void *fp) {
+  const auto &bounds = thread_stack_bounds();
+  return fripack::stacks::capture(reinterpret_cast<uintptr_t>(pc),
+                                  reinterpret_cast<uintptr_t>(fp), bounds.low,
+                                  bounds.high);
+}
+
+// One frame per line. Both are called like fripack_startup_phases().
+EXPORT size_t fripack_stack_symbolize(int32_t id, char *buffer, size_t size) {
+  std::string text;
+  for (const auto &frame : fripack::stacks::frames(id)) {
+    text += frame;
+    text += '\n';
+  }
+  return fripack::copyOut(text, buffer, size);
+}
+
+EXPORT size_t fripack_stack_dump(char *buffer, size_t size) {
+  return fripack::copyOut(fripack::stacks::toJson(), buffer, size);
+}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cheap stack capture for hot hooks. Capturing walks the frame-pointer
+// chain into a preallocated, hash-deduplicated table without locking or
+// allocating, so it is async-signal-safe. Frames are turned into text
+// later, on a background thread, through a cache of module ranges and
+// symbols. On 32-bit ARM only clang's {fp, lr} frame records are followed.
+namespace fripack::stacks {
+inline constexpr size_t kMaxFrames = 32;
+inline constexpr int32_t kNoStack = -1;
+
+// Walks from the given frame (the caller's own if fp is null), bounded to
+// [stack_low, stack_high) when those are non-zero. Returns the id of the
+// stack in the table, or kNoStack if the table is full.
+int32_t capture(uintptr_t pc, uintptr_t fp, uintptr_t stack_low,
+                uintptr_t stack_high);
+
+// "module+0xoffset symbol" per frame, or the bare address outside any
+// module. Uses and fills the symbol cache; not for signal handlers.
+std::vector<std::string> symbolize(const uintptr_t *frames, size_t count);
+
+// Frames of a captured stack, symbolized.
+std::vector<std::string> frames(int32_t id);
+
+// {"dropped":N,"stacks":[{"id":..,"count":..,"frames":[..]},..]}, most
+// frequent first.
+std::string toJson();
+
+// Starts the background symbolizer. Gum must be initialized. Safe to call
+// repeatedly; captures made before it starts are symbolized once it does.
+void startSymbolizer();
+
+// Joins the symbolizer for good: later startSymbolizer() calls do nothing,
+// and stacks are then only symbolized when asked for.
+void stopSymbolizer();
+} // namespace fripack::stacks
@@ -1,11 +1,12 @@
 #include "stacktrace.h"
 
 #ifdef __ANDROID__
-#include <iostream>
-#include <iomanip>
-#include <sstream>
+#include <cstdint>
 #include <unwind.h>
-#include <dlfcn.h>
+
+#include <fmt/format.h>
+
+#include "stack_table.h"
 
 namespace {
 
@@ -39,46 +40,21 @@ size_t captureBacktrace(void** buffer, size_t max)
     return state.current - buffer;
 }
 
-void dumpBacktrace(std::ostream& os, void** buffer, size_t count)
-{
-    // Get current module base address
-    Dl_info current_module_info;
-    void* current_module_base = nullptr;
-    if (dladdr(reinterpret_cast<const void*>(dumpBacktrace), &current_module_info)) {
-        current_module_base = const_cast<void*>(current_module_info.dli_fbase);
-    }
-
-    for (size_t idx = 0; idx < count; ++idx) {
-        const void* addr = buffer[idx];
-        const char* symbol = "";
-
-        Dl_info info;
-        if (dladdr(addr, &info) && info.dli_sname) {
-            symbol = info.dli_sname;
-        }
-
-        // Check if address is within current module
-        if (current_module_base && info.dli_fbase == current_module_base) {
-            uintptr_t offset = reinterpret_cast<uintptr_t>(addr) - reinterpret_cast<uintptr_t>(current_module_base);
-            const char* module_name = current_module_info.dli_fname ?
-                strrchr(current_module_info.dli_fname, '/') ? strrchr(current_module_info.dli_fname, '/') + 1 :
-                current_module_info.dli_fname : "unknown.so";
-            os << "  #" << std::setw(2) << idx << ": " << module_name << " + 0x" << std::hex << offset << std::dec << "  " << symbol << "\n";
-        } else {
-            os << "  #" << std::setw(2) << idx << ": " << addr << "  " << symbol << "\n";
-        }
-    }
-}
-
 std::string fripack::getBacktraceString()
 {
     constexpr size_t max_frames = 64;
     void* buffer[max_frames];
     size_t count = captureBacktrace(buffer, max_frames);
 
-    std::ostringstream oss;
-    dumpBacktrace(oss, buffer, count);
-    return oss.str();
+    // Symbols come from the stack table's cache, so repeated frames cost a
+    // map lookup instead of a dladdr() each.
+    auto frames = fripack::stacks::symbolize(
+        reinterpret_cast<const uintptr_t*>(buffer), count);
+    std::string out;
+    for (size_t idx = 0; idx < frames.size(); ++idx) {
+        out += fmt::format("  #{:2}: {}\n", idx, frames[idx]);
+    }
+    return out;
 }
 #else
 #include <string>
@@ -0,0 +1,127 @@
+#include "startup.h"
+#include "export.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace fripack::startup {
+namespace {
+constexpr size_t kPhaseCount = static_cast<size_t>(Phase::Count);
+
+constexpr std::array<const char *, kPhaseCount> kPhaseNames = {
+    "library_loaded", "config_thread_started", "config_decoded",
+    "gum_initialized", "backend_obtained",     "hooks_installed",
+    "sources_ready",   "scripts_created",      "scripts_loaded",
+};
+
+// steady_clock nanoseconds; 0 means not reached.
+std::array<std::atomic<int64_t>, kPhaseCount> g_marks{};
+
+// VmRSS and VmHWM in KiB, or -1 where /proc is not available.
+std::pair<int64_t, int64_t> memory_kb() {
+  std::pair<int64_t, int64_t> kb{-1, -1};
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.starts_with("VmRSS:")) {
+      kb.first = std::strtoll(line.c_str() + 6, nullptr, 10);
+    } else if (line.starts_with("VmHWM:")) {
+      kb.second = std::strtoll(line.c_str() + 6, nullptr, 10);
+    }
+  }
+  return kb;
+}
+
+int64_t since_load_us(size_t phase) {
+  return (g_marks[phase].load(std::memory_order_acquire) -
+          g_marks[0].load(std::memory_order_acquire)) /
+         1000;
+}
+} // namespace
+
+void mark(Phase phase) {
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  int64_t unset = 0;
+  g_marks[static_cast<size_t>(phase)].compare_exchange_strong(
+      unset, now, std::memory_order_release, std::memory_order_relaxed);
+}
+
+int64_t sinceLoadNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+             .count() -
+         g_marks[0].load(std::memory_order_acquire);
+}
+
+std::string toJson() {
+  std::string json =
+      fmt::format("{{\"{}_ns\":{}", kPhaseNames[0],
+                  g_marks[0].load(std::memory_order_acquire));
+  for (size_t i = 1; i < kPhaseCount; ++i) {
+    if (g_marks[i].load(std::memory_order_acquire) != 0) {
+      json += fmt::format(",\"{}_us\":{}", kPhaseNames[i], since_load_us(i));
+    }
+  }
+  json += "}";
+  return json;
+}
+
+void report(const std::optional<std::string> &path) {
+  // Gum startup and config decoding overlap, so phases are reported as
+  // offsets from library load rather than as deltas.
+  std::string summary;
+  int64_t total = 0;
+  for (size_t i = 1; i < kPhaseCount; ++i) {
+    if (g_marks[i].load(std::memory_order_acquire) == 0) {
+      continue;
+    }
+    int64_t at = since_load_us(i);
+    summary += fmt::format(" {} {}", kPhaseNames[i], at);
+    total = std::max(total, at);
+  }
+  logger::println("[*] Startup phases (us since load):{}, total {}", summary,
+                  total);
+  // The peak covers everything startup held at once, e.g. copies of the
+  // script text.
+  auto [rss_kb, peak_rss_kb] = memory_kb();
+  if (rss_kb >= 0) {
+    logger::println("[*] Startup memory: rss {} KiB, peak {} KiB", rss_kb,
+                    peak_rss_kb);
+  }
+
+  if (path) {
+    std::ofstream out(*path, std::ios::app);
+    if (!out) {
+      logger::warn("Failed to open startup report file: {}", *path);
+      return;
+    }
+    out << fmt::format("{{\"pid\":{},\"phases\":{},\"rss_kb\":{},"
+                       "\"peak_rss_kb\":{}}}\n",
+                       getpid(), toJson(), rss_kb, peak_rss_kb);
+  }
+}
+} // namespace fripack::startup
+
+// For scripts: new NativeFunction(<export>, 'size_t', ['pointer', 'size_t'])
+// with a Memory.alloc() buffer, then buffer.readUtf8String(). Returns the
+// full length; the text is cut short if the buffer is smaller.
+extern "C" EXPORT size_t fripack_startup_phases(char *buffer, size_t size) {
+  return fripack::copyOut(fripack::startup::toJson(), buffer, size);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace fripack::startup {
+// Startup milestones, in the order they are reached.
+enum class Phase {
+  LibraryLoaded,
+  ConfigThreadStarted,
+  ConfigDecoded,
+  GumInitialized,
+  BackendObtained,
+  HooksInstalled,
+  SourcesReady,
+  ScriptsCreated,
+  ScriptsLoaded,
+  Count,
+};
+
+// Records the monotonic time a phase was reached. Thread-safe; only the
+// first mark of each phase counts.
+void mark(Phase phase);
+
+// Nanoseconds since LibraryLoaded was marked.
+int64_t sinceLoadNs();
+
+// {"library_loaded_ns":<monotonic>,"config_decoded_us":<since load>,...}
+// with phases not reached yet left out.
+std::string toJson();
+
+// Logs a one-line summary and the current and peak RSS and, if path is
+// set, appends {"pid":...,"phases":{...},"rss_kb":...,"peak_rss_kb":...}
+// to it as one line (-1 where the RSS is unknown).
+void report(const std::optional<std::string> &path);
+} // namespace fripack::startup
@@ -0,0 +1,366 @@
+#include "symbol_index.h"
+#include "export.h"
+#include "logger.h"
+
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fripack::symbols {
+namespace {
+constexpr uint32_t kIndexMagic = 0x58595346; // "FSYX"
+constexpr uint32_t kIndexVersion = 1;
+constexpr const char *kIndexExtension = ".symidx";
+
+// File layout: IndexHeader | IndexSlot[table_size] | names. Slots are an
+// open-addressing table on the name hash; a zero hash marks an empty slot.
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t table_size; // Power of two.
+  uint32_t count;
+  uint64_t names_offset;
+  uint64_t names_size;
+};
+
+struct IndexSlot {
+  uint64_t hash;
+  uint64_t offset; // From the module base.
+  uint32_t name_offset;
+  uint32_t name_size;
+};
+
+uint64_t hash_name(std::string_view name) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char c : name) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+class ModuleIndex {
+public:
+  ModuleIndex(std::string owned) : owned_(std::move(owned)) {
+    data_ = reinterpret_cast<const uint8_t *>(owned_.data());
+    size_ = owned_.size();
+  }
+
+  ModuleIndex(void *mapping, size_t size)
+      : mapping_(mapping), data_(static_cast<const uint8_t *>(mapping)),
+        size_(size) {}
+
+  ~ModuleIndex() {
+#ifndef _WIN32
+    if (mapping_) {
+      munmap(mapping_, size_);
+    }
+#endif
+  }
+
+  ModuleIndex(const ModuleIndex &) = delete;
+  ModuleIndex &operator=(const ModuleIndex &) = delete;
+
+  // Checks a file read from disk before trusting its offsets.
+  bool valid() const {
+    if (size_ < sizeof(IndexHeader)) {
+      return false;
+    }
+    const auto *h = header();
+    uint64_t table_end =
+        sizeof(IndexHeader) + uint64_t{h->table_size} * sizeof(IndexSlot);
+    return h->magic == kIndexMagic && h->version == kIndexVersion &&
+           h->table_size != 0 && (h->table_size & (h->table_size - 1)) == 0 &&
+           table_end <= h->names_offset &&
+           h->names_offset + h->names_size == size_;
+  }
+
+  std::optional<uint64_t> find(std::string_view name) const {
+    const auto *h = header();
+    const auto *slots =
+        reinterpret_cast<const IndexSlot *>(data_ + sizeof(IndexHeader));
+    const char *names = reinterpret_cast<const char *>(data_ + h->names_offset);
+    uint64_t hash = hash_name(name);
+    for (uint32_t probe = 0; probe < h->table_size; ++probe) {
+      const IndexSlot &slot = slots[(hash + probe) & (h->table_size - 1)];
+      if (slot.hash == 0) {
+        break;
+      }
+      if (slot.hash == hash && slot.name_size == name.size() &&
+          uint64_t{slot.name_offset} + slot.name_size <= h->names_size &&
+          std::memcmp(names + slot.name_offset, name.data(), name.size()) ==
+              0) {
+        return slot.offset;
+      }
+    }
+    return std::nullopt;
+  }
+
+private:
+  const IndexHeader *header() const {
+    return reinterpret_cast<const IndexHeader *>(data_);
+  }
+
+  std::string owned_;
+  void *mapping_ = nullptr;
+  const uint8_t *data_;
+  size_t size_;
+};
+
+struct LoadedModule {
+  GumAddress base = 0;
+  std::string build_id;
+  std::unique_ptr<ModuleIndex> index;
+};
+
+std::mutex g_mutex;
+std::optional<std::filesystem::path> g_cache_dir;
+std::map<std::string, LoadedModule, std::less<>> g_modules;
+
+// Hex GNU build-id read from the module's mapped PT_NOTE segments.
+std::string build_id(GumAddress base) {
+#ifdef _WIN32
+  return {};
+#else
+  const auto *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(base);
+  if (std::memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0) {
+    return {};
+  }
+  const auto *phdrs =
+      reinterpret_cast<const ElfW(Phdr) *>(base + ehdr->e_phoff);
+
+  // The base is where the lowest PT_LOAD is mapped.
+  ElfW(Addr) bias = base;
+  for (size_t i = 0; i < ehdr->e_phnum; ++i) {
+    if (phdrs[i].p_type == PT_LOAD) {
+      bias = base - (phdrs[i].p_vaddr & ~ElfW(Addr){0xfff});
+      break;
+    }
+  }
+
+  for (size_t i = 0; i < ehdr->e_phnum; ++i) {
+    if (phdrs[i].p_type != PT_NOTE) {
+      continue;
+    }
+    const auto *note =
+        reinterpret_cast<const uint8_t *>(bias + phdrs[i].p_vaddr);
+    const auto *end = note + phdrs[i].p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end) {
+      const auto *nhdr = reinterpret_cast<const ElfW(Nhdr) *>(note);
+      const uint8_t *name = note + sizeof(ElfW(Nhdr));
+      const uint8_t *desc = name + ((nhdr->n_namesz + 3) & ~3u);
+      if (desc + nhdr->n_descsz > end) {
+        break;
+      }
+      if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+          std::memcmp(name, "GNU", 4) == 0) {
+        std::string hex;
+        for (uint32_t b = 0; b < nhdr->n_descsz; ++b) {
+          hex += fmt::format("{:02x}", desc[b]);
+        }
+        return hex;
+      }
+      note = desc + ((nhdr->n_descsz + 3) & ~3u);
+    }
+  }
+  return {};
+#endif
+}
+
+// Exports win over symbol-table entries of the same name, like a dynamic
+// lookup would.
+std::string build_index(GumModule *module, GumAddress base) {
+  struct Collected {
+    GumAddress base;
+    std::unordered_map<std::string, uint64_t> entries;
+  } collected{base, {}};
+
+  gum_module_enumerate_exports(
+      module,
+      [](const GumExportDetails *details, gpointer user_data) -> gboolean {
+        auto *c = static_cast<Collected *>(user_data);
+        if (details->address >= c->base) {
+          c->entries.emplace(details->name, details->address - c->base);
+        }
+        return TRUE;
+      },
+      &collected);
+  gum_module_enumerate_symbols(
+      module,
+      [](const GumSymbolDetails *details, gpointer user_data) -> gboolean {
+        auto *c = static_cast<Collected *>(user_data);
+        if (details->address >= c->base && details->name[0] != '\0') {
+          c->entries.emplace(details->name, details->address - c->base);
+        }
+        return TRUE;
+      },
+      &collected);
+
+  uint32_t table_size = 16;
+  while (table_size < collected.entries.size() * 2) {
+    table_size *= 2;
+  }
+
+  std::vector<IndexSlot> slots(table_size);
+  std::string names;
+  for (const auto &[name, offset] : collected.entries) {
+    uint64_t hash = hash_name(name);
+    uint32_t i = hash & (table_size - 1);
+    while (slots[i].hash != 0) {
+      i = (i + 1) & (table_size - 1);
+    }
+    slots[i] = {hash, offset, static_cast<uint32_t>(names.size()),
+                static_cast<uint32_t>(name.size())};
+    names += name;
+  }
+
+  IndexHeader header{kIndexMagic,
+                     kIndexVersion,
+                     table_size,
+                     static_cast<uint32_t>(collected.entries.size()),
+                     sizeof(IndexHeader) + table_size * sizeof(IndexSlot),
+                     names.size()};
+  std::string out(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.append(reinterpret_cast<const char *>(slots.data()),
+             slots.size() * sizeof(IndexSlot));
+  out += names;
+  return out;
+}
+
+std::unique_ptr<ModuleIndex> map_index(const std::filesystem::path &path) {
+#ifdef _WIN32
+  return nullptr;
+#else
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return nullptr;
+  }
+  struct stat st;
+  void *mapping = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return nullptr;
+  }
+
+  auto index = std::make_unique<ModuleIndex>(mapping, st.st_size);
+  if (!index->valid()) {
+    logger::warn("Ignoring corrupt symbol index {}", path.string());
+    return nullptr;
+  }
+  return index;
+#endif
+}
+
+// Through a temporary file of its own and a rename, so processes sharing
+// the cache directory never map a torn index.
+void store_index(const std::filesystem::path &path, const std::string &data) {
+  GError *error = nullptr;
+  if (!g_file_set_contents(path.string().c_str(), data.data(), data.size(),
+                           &error)) {
+    logger::error("Failed to write symbol index {}: {}", path.string(),
+                  error->message);
+    g_error_free(error);
+  }
+}
+
+// Caller holds g_mutex. A cached index is only used while the module is
+// still mapped at the same base with the same build-id: a library that was
+// unloaded and loaded again may sit elsewhere or be a different build.
+LoadedModule *load_module(std::string_view name) {
+  auto it = g_modules.find(name);
+  GumModule *module =
+      gum_process_find_module_by_name(std::string(name).c_str());
+  if (!module) {
+    if (it != g_modules.end()) {
+      g_modules.erase(it);
+    }
+    return nullptr;
+  }
+  GumAddress base = gum_module_get_range(module)->base_address;
+  std::string id = build_id(base);
+  if (it != g_modules.end()) {
+    if (it->second.base == base && it->second.build_id == id) {
+      g_object_unref(module);
+      return &it->second;
+    }
+    logger::debug("{} was reloaded, reindexing it", name);
+    g_modules.erase(it);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  LoadedModule loaded;
+  loaded.base = base;
+  loaded.build_id = id;
+
+  std::optional<std::filesystem::path> path;
+  if (g_cache_dir && !id.empty()) {
+    path = *g_cache_dir / (id + kIndexExtension);
+    loaded.index = map_index(*path);
+  }
+  bool hit = loaded.index != nullptr;
+  if (!hit) {
+    std::string data = build_index(module, loaded.base);
+    if (path) {
+      store_index(*path, data);
+    }
+    loaded.index = std::make_unique<ModuleIndex>(std::move(data));
+  }
+  g_object_unref(module);
+
+  logger::debug("Symbol index for {} {} in {} us", name,
+                hit ? "mapped" : "built",
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count());
+  return &g_modules.emplace(std::string(name), std::move(loaded))
+              .first->second;
+}
+} // namespace
+
+void setCacheDir(std::filesystem::path dir) {
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (ec) {
+    logger::error("Failed to create symbol index dir {}: {}", dir.string(),
+                  ec.message());
+    return;
+  }
+  std::lock_guard lock(g_mutex);
+  g_cache_dir = std::move(dir);
+}
+
+GumAddress resolve(const std::string &module, const std::string &symbol) {
+  std::lock_guard lock(g_mutex);
+  LoadedModule *loaded = load_module(module);
+  if (!loaded) {
+    return 0;
+  }
+  auto offset = loaded->index->find(symbol);
+  return offset ? loaded->base + *offset : 0;
+}
+} // namespace fripack::symbols
+
+// For scripts, in place of Process.getModuleByName(m).getExportByName(s):
+// new NativeFunction(<export>, 'pointer', ['pointer', 'pointer']). Returns
+// NULL when the symbol is not found.
+extern "C" EXPORT void *fripack_resolve_symbol(const char *module,
+                                               const char *symbol) {
+  return GSIZE_TO_POINTER(fripack::symbols::resolve(module, symbol));
+}
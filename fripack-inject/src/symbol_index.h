@@ -0,0 +1,18 @@
+#pragma once
+#include <filesystem>
+#include <string>
+
+#include "frida-gumjs.h"
+
+namespace fripack::symbols {
+// Directory for per-module indexes, which are named after the module's GNU
+// build-id and memory-mapped on later launches. Without it, or for modules
+// without a build-id, indexes are built per process and kept in memory.
+void setCacheDir(std::filesystem::path dir);
+
+// Address of an export of the module, or of a symbol-table entry when no
+// export has that name. Returns 0 if neither exists or the module is not
+// loaded. The first lookup in a module indexes it; later ones are a hash
+// probe.
+GumAddress resolve(const std::string &module, const std::string &symbol);
+} // namespace fripack::symbols
@@ -0,0 +1,149 @@
+#include "trace.h"
+#include "logger.h"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace fripack::trace {
+
+#ifndef _WIN32
+TraceRecorder::TraceRecorder(int fd, uint8_t *base, size_t mapped_size)
+    : fd_(fd), base_(base), mapped_size_(mapped_size),
+      header_(reinterpret_cast<FileHeader *>(base)),
+      records_(base + sizeof(FileHeader)) {}
+
+TraceRecorder::~TraceRecorder() {
+  msync(base_, mapped_size_, MS_ASYNC);
+  munmap(base_, mapped_size_);
+  close(fd_);
+}
+
+std::unique_ptr<TraceRecorder> TraceRecorder::open(const std::string &path,
+                                                   uint64_t capacity) {
+  capacity = align_up(capacity);
+  if (capacity < 2 * sizeof(RecordHeader)) {
+    logger::error("Trace capacity {} is too small", capacity);
+    return nullptr;
+  }
+
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    logger::error("Failed to open trace file {}: {}", path, strerror(errno));
+    return nullptr;
+  }
+
+  size_t mapped_size = sizeof(FileHeader) + capacity;
+  if (ftruncate(fd, mapped_size) == -1) {
+    logger::error("Failed to size trace file {}: {}", path, strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+
+  void *base =
+      mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    logger::error("Failed to map trace file {}: {}", path, strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+
+  auto *header = static_cast<FileHeader *>(base);
+  *header = {};
+  header->magic = kMagic;
+  header->version = kVersion;
+  header->capacity = capacity;
+
+  logger::println("[*] Recording trace to {} ({} bytes)", path, capacity);
+  return std::unique_ptr<TraceRecorder>(
+      new TraceRecorder(fd, static_cast<uint8_t *>(base), mapped_size));
+}
+
+RecordHeader *TraceRecorder::record_at(uint64_t offset) {
+  return reinterpret_cast<RecordHeader *>(records_ +
+                                          offset % header_->capacity);
+}
+
+// Drops the oldest records until `needed` more bytes fit after tail.
+void TraceRecorder::make_room(uint64_t needed) {
+  while (header_->tail + needed - header_->head > header_->capacity) {
+    uint64_t physical = header_->head % header_->capacity;
+    uint64_t remaining = header_->capacity - physical;
+    if (remaining < sizeof(RecordHeader)) {
+      header_->head += remaining;
+      continue;
+    }
+
+    auto *record = record_at(header_->head);
+    header_->head += record->size;
+    if (record->kind == static_cast<uint32_t>(RecordKind::Message)) {
+      header_->records_overwritten++;
+    }
+  }
+}
+
+void TraceRecorder::append(std::string_view message, const void *data,
+                           size_t data_size) {
+  uint64_t size =
+      align_up(sizeof(RecordHeader) + message.size() + data_size);
+  if (size > header_->capacity) {
+    logger::warn("Trace record of {} bytes exceeds the ring capacity", size);
+    return;
+  }
+
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  std::lock_guard lock(mutex_);
+
+  uint64_t remaining = header_->capacity - header_->tail % header_->capacity;
+  if (remaining < size) {
+    make_room(remaining);
+    if (remaining >= sizeof(RecordHeader)) {
+      *record_at(header_->tail) = {static_cast<uint32_t>(remaining),
+                                   static_cast<uint32_t>(RecordKind::Padding),
+                                   0, 0, 0};
+    }
+    header_->tail += remaining;
+  }
+
+  make_room(size);
+  auto *record = record_at(header_->tail);
+  *record = {static_cast<uint32_t>(size),
+             static_cast<uint32_t>(RecordKind::Message),
+             static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec,
+             static_cast<uint32_t>(message.size()),
+             static_cast<uint32_t>(data_size)};
+  auto *payload = reinterpret_cast<uint8_t *>(record + 1);
+  std::memcpy(payload, message.data(), message.size());
+  if (data_size) {
+    std::memcpy(payload + message.size(), data, data_size);
+  }
+
+  header_->tail += size;
+  header_->records_written++;
+}
+#else
+TraceRecorder::TraceRecorder(int fd, uint8_t *base, size_t mapped_size)
+    : fd_(fd), base_(base), mapped_size_(mapped_size), header_(nullptr),
+      records_(nullptr) {}
+
+TraceRecorder::~TraceRecorder() = default;
+
+std::unique_ptr<TraceRecorder> TraceRecorder::open(const std::string &path,
+                                                   uint64_t capacity) {
+  logger::warn("Trace recording is not supported on this platform");
+  return nullptr;
+}
+
+void TraceRecorder::append(std::string_view message, const void *data,
+                           size_t data_size) {}
+#endif
+
+} // namespace fripack::trace
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "trace_format.h"
+
+namespace fripack::trace {
+// Appends script messages and their binary attachments to a memory-mapped
+// ring file, overwriting the oldest records once it is full. Decode the file
+// with the fripack-trace-decode tool.
+class TraceRecorder {
+public:
+  ~TraceRecorder();
+
+  TraceRecorder(const TraceRecorder &) = delete;
+  TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+  // Creates (or truncates) the file at path. Returns nullptr on failure or
+  // on platforms without mmap support.
+  static std::unique_ptr<TraceRecorder> open(const std::string &path,
+                                             uint64_t capacity);
+
+  void append(std::string_view message, const void *data, size_t data_size);
+
+private:
+  TraceRecorder(int fd, uint8_t *base, size_t mapped_size);
+
+  RecordHeader *record_at(uint64_t offset);
+  void make_room(uint64_t needed);
+
+  int fd_;
+  uint8_t *base_;
+  size_t mapped_size_;
+  FileHeader *header_;
+  uint8_t *records_;
+  std::mutex mutex_;
+};
+} // namespace fripack::trace
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+
+// On-disk layout of the trace ring file, shared by the recorder and the
+// host-side decoder. All integers are little-endian.
+//
+// The file is a FileHeader followed by `capacity` bytes of record area.
+// head and tail are logical byte offsets that only grow; a record lives at
+// (offset % capacity). Records never straddle the end of the area: the
+// writer fills the remainder with a Padding record (or leaves it blank when
+// fewer than sizeof(RecordHeader) bytes remain) and wraps to the start.
+namespace fripack::trace {
+
+constexpr uint32_t kMagic = 0x52545046; // "FPTR"
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kAlignment = 8;
+
+enum class RecordKind : uint32_t {
+  Message = 1,
+  Padding = 2,
+};
+
+#pragma pack(push, 1)
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  uint64_t head;
+  uint64_t tail;
+  uint64_t records_written;
+  uint64_t records_overwritten;
+  uint8_t reserved[16];
+};
+
+// Followed by message_size bytes of the script message (JSON), then
+// data_size bytes of the attached blob, then padding up to kAlignment.
+struct RecordHeader {
+  uint32_t size; // Whole record including header and padding.
+  uint32_t kind;
+  uint64_t timestamp_ns; // CLOCK_REALTIME.
+  uint32_t message_size;
+  uint32_t data_size;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FileHeader) == 64);
+static_assert(sizeof(RecordHeader) == 24);
+
+inline uint64_t align_up(uint64_t value) {
+  return (value + kAlignment - 1) & ~uint64_t{kAlignment - 1};
+}
+
+} // namespace fripack::trace
@@ -0,0 +1,158 @@
+// Reads the live metrics segment published by fripack-inject and prints it
+// as one JSON line per sample:
+//
+//   {"pid":1234,"state":"running","uptime_ns":...,"messages":{...},...}
+//
+// Usage: fripack-metrics-read <segment> [--watch <ms>]
+//
+// <segment> is the configured metrics path, or /proc/<pid>/fd/<n> for the
+// default memfd (as logged by the agent). With --watch it keeps polling
+// until the agent stops publishing.
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "metrics_format.h"
+
+using namespace fripack::metrics;
+
+namespace {
+
+std::string escape(std::string_view text) {
+  std::string out;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out += fmt::format("\\u{:04x}", c);
+    } else {
+      out.push_back(c);
+    }
+  }
+  return out;
+}
+
+// Copies the counters under the seqlock. Returns false if the writer kept
+// the lock for the whole attempt.
+bool read_counters(Segment *segment, Counters &out) {
+  std::atomic_ref seq(segment->seq);
+  for (int attempt = 0; attempt < 1000; ++attempt) {
+    uint32_t before = seq.load(std::memory_order_acquire);
+    if (before & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    std::memcpy(&out, &segment->counters, sizeof(out));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq.load(std::memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void print(const Segment *segment, const Counters &counters, bool stopped) {
+  std::string hooks;
+  size_t shown = std::min<uint64_t>(counters.hook_count, kMaxHooks);
+  for (size_t i = 0; i < shown; ++i) {
+    const Hook &hook = counters.hooks[i];
+    hooks += fmt::format(
+        "{}{{\"name\":\"{}\",\"calls\":{},\"total_ns\":{}}}", i ? "," : "",
+        escape(std::string_view(hook.name, strnlen(hook.name, kHookNameSize))),
+        hook.calls, hook.total_ns);
+  }
+  fmt::print("{{\"pid\":{},\"state\":\"{}\",\"uptime_ns\":{},"
+             "\"updated_ns\":{},"
+             "\"messages\":{{\"queued\":{},\"handled\":{},\"dropped\":{},"
+             "\"blocked\":{}}},"
+             "\"log\":{{\"bytes\":{},\"dropped\":{}}},"
+             "\"reloads\":{{\"count\":{},\"failures\":{},\"last_us\":{},"
+             "\"total_us\":{}}},"
+             "\"heap_bytes\":{},\"hook_count\":{},\"hook_calls\":{},"
+             "\"hooks\":[{}]}}\n",
+             segment->pid, stopped ? "stopped" : "running",
+             counters.uptime_ns, counters.updated_ns, counters.messages_queued,
+             counters.messages_handled, counters.messages_dropped,
+             counters.messages_blocked, counters.log_bytes,
+             counters.log_dropped, counters.reloads, counters.reload_failures,
+             counters.last_reload_us, counters.total_reload_us,
+             counters.heap_bytes, counters.hook_count, counters.hook_calls,
+             hooks);
+  std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fmt::print(stderr, "Usage: {} <segment> [--watch <ms>]\n", argv[0]);
+    return 2;
+  }
+  long watch_ms = 0;
+  if (argc > 3 && std::strcmp(argv[2], "--watch") == 0) {
+    watch_ms = std::strtol(argv[3], nullptr, 10);
+  }
+
+  int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    fmt::print(stderr, "{}: {}\n", argv[1], std::strerror(errno));
+    return 1;
+  }
+  // Touching a mapped page past the end of the file raises SIGBUS, so the
+  // size is checked before the first read and again before every sample.
+  auto whole = [&]() {
+    struct stat st;
+    return fstat(fd, &st) == 0 &&
+           static_cast<uint64_t>(st.st_size) >= sizeof(Segment);
+  };
+  if (!whole()) {
+    fmt::print(stderr, "{}: too small to be a metrics segment\n", argv[1]);
+    return 1;
+  }
+  void *base = mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    fmt::print(stderr, "{}: {}\n", argv[1], std::strerror(errno));
+    return 1;
+  }
+  auto *segment = static_cast<Segment *>(base);
+  if (segment->magic != kMagic || segment->version != kVersion ||
+      segment->size != sizeof(Segment)) {
+    fmt::print(stderr, "{}: not a metrics segment of version {}\n", argv[1],
+               kVersion);
+    return 1;
+  }
+
+  while (true) {
+    if (!whole()) {
+      fmt::print(stderr, "{}: segment was truncated\n", argv[1]);
+      return 1;
+    }
+    bool stopped = std::atomic_ref(segment->state)
+                       .load(std::memory_order_acquire) ==
+                   static_cast<uint32_t>(State::Stopped);
+    Counters counters;
+    if (!read_counters(segment, counters)) {
+      fmt::print(stderr, "{}: writer never released the segment\n", argv[1]);
+      return 1;
+    }
+    print(segment, counters, stopped);
+    if (watch_ms <= 0 || stopped) {
+      return 0;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(watch_ms));
+  }
+}
@@ -0,0 +1,103 @@
+// Decodes a trace ring file written by fripack-inject's trace recorder into
+// JSON lines, oldest record first:
+//
+//   {"ts_ns":1712345678901234567,"message":{...},"data":"0a1b..."}
+//
+// Usage: fripack-trace-decode <trace-file> [--no-data]
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "trace_format.h"
+
+using namespace fripack::trace;
+
+namespace {
+
+std::string to_hex(const uint8_t *data, size_t size) {
+  static constexpr char digits[] = "0123456789abcdef";
+  std::string out(size * 2, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    out[2 * i] = digits[data[i] >> 4];
+    out[2 * i + 1] = digits[data[i] & 0xf];
+  }
+  return out;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fmt::print(stderr, "Usage: {} <trace-file> [--no-data]\n", argv[0]);
+    return 2;
+  }
+  bool with_data = !(argc > 2 && std::strcmp(argv[2], "--no-data") == 0);
+
+  std::ifstream file(argv[1], std::ios::binary);
+  std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)),
+                                std::istreambuf_iterator<char>());
+  if (contents.size() < sizeof(FileHeader)) {
+    fmt::print(stderr, "{}: too small to be a trace file\n", argv[1]);
+    return 1;
+  }
+
+  FileHeader header;
+  std::memcpy(&header, contents.data(), sizeof(header));
+  if (header.magic != kMagic || header.version != kVersion ||
+      contents.size() < sizeof(FileHeader) + header.capacity) {
+    fmt::print(stderr, "{}: bad header or truncated file\n", argv[1]);
+    return 1;
+  }
+
+  const uint8_t *records = contents.data() + sizeof(FileHeader);
+  uint64_t decoded = 0;
+  for (uint64_t offset = header.head; offset < header.tail;) {
+    uint64_t physical = offset % header.capacity;
+    uint64_t remaining = header.capacity - physical;
+    if (remaining < sizeof(RecordHeader)) {
+      offset += remaining;
+      continue;
+    }
+
+    RecordHeader record;
+    std::memcpy(&record, records + physical, sizeof(record));
+    if (record.size < sizeof(RecordHeader) || record.size > remaining) {
+      fmt::print(stderr, "corrupt record at offset {}\n", offset);
+      return 1;
+    }
+
+    if (record.kind == static_cast<uint32_t>(RecordKind::Message)) {
+      // A record torn by a crash mid-write can claim more than it holds.
+      if (sizeof(RecordHeader) + uint64_t{record.message_size} +
+              record.data_size >
+          record.size) {
+        fmt::print(stderr, "corrupt record at offset {}\n", offset);
+        return 1;
+      }
+      const uint8_t *payload = records + physical + sizeof(RecordHeader);
+      std::string_view message(reinterpret_cast<const char *>(payload),
+                               record.message_size);
+      fmt::print("{{\"ts_ns\":{},\"message\":{}", record.timestamp_ns,
+                 message.empty() ? "null" : message);
+      if (with_data && record.data_size) {
+        fmt::print(",\"data\":\"{}\"",
+                   to_hex(payload + record.message_size, record.data_size));
+      } else if (record.data_size) {
+        fmt::print(",\"data_size\":{}", record.data_size);
+      }
+      fmt::print("}}\n");
+      decoded++;
+    }
+    offset += record.size;
+  }
+
+  fmt::print(stderr, "{} records decoded, {} written, {} overwritten\n",
+             decoded, header.records_written, header.records_overwritten);
+  return 0;
+}
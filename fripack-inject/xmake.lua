@@ -6,8 +6,14 @@ if is_plat("windows") then
     set_runtimes("MT")
 end
 
+option("frida_version")
+    set_default("")
+    set_showmenu(true)
+    set_description("Frida version of the devkit, keys the bytecode cache")
+option_end()
+
 includes("./deps/frida-gumjs-devkit.lua")
-add_requires("fmt", "frida-gumjs-devkit", "xz", "reflect-cpp")
+add_requires("fmt", "frida-gumjs-devkit", "xz", "zstd", "lz4", "reflect-cpp")
 
 local should_hook = is_plat("android") and (is_arch("arm64-v8a") or is_arch("armeabi-v7a"))
 if should_hook then
@@ -17,19 +23,81 @@ end
 target("fripack-inject")
     set_kind("shared")
     add_files("src/**.cc")
-    add_packages("fmt", "frida-gumjs-devkit", "xz", "reflect-cpp")
+    add_packages("fmt", "frida-gumjs-devkit", "xz", "zstd", "lz4", "reflect-cpp")
     
     set_strip("all")
     set_symbols("hidden")
     set_optimize("smallest")
 
+    if is_mode("release") then
+        add_defines("FRIPACK_LOG_MIN_LEVEL=1")
+    end
+
+    local frida_version = get_config("frida_version")
+    if frida_version and frida_version ~= "" then
+        add_defines("FRIPACK_FRIDA_VERSION=\"" .. frida_version .. "\"")
+    end
+
     if should_hook then
         add_packages("shadowhook")
     end
 
+    -- Counts interceptor changes for the load/reload/unload windows
+    -- (src/patch_window.cc). GNU ld and lld only.
+    if is_plat("linux", "android") then
+        add_defines("FRIPACK_COUNT_INTERCEPTOR_CHANGES")
+        for _, fn in ipairs({"attach", "detach", "replace", "replace_fast", "revert"}) do
+            add_shflags("-Wl,--wrap=gum_interceptor_" .. fn, {force = true})
+        end
+    end
+
+    if is_plat("android") then
+        add_syslinks("log")
+    elseif is_plat("windows") then
+        add_defines("NOMINMAX", "WIN32_LEAN_AND_MEAN")
+        add_syslinks("ole32", "user32", "advapi32", "shell32")
+    end
+target("fripack-bench-message")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/message_bench.cc", "src/message.cc")
+    add_includedirs("src")
+    add_packages("fmt", "frida-gumjs-devkit")
+
     if is_plat("android") then
         add_syslinks("log")
+    elseif is_plat("linux") then
+        add_syslinks("pthread", "dl", "m", "resolv")
     elseif is_plat("windows") then
         add_defines("NOMINMAX", "WIN32_LEAN_AND_MEAN")
         add_syslinks("ole32", "user32", "advapi32", "shell32")
-    end
\ No newline at end of file
+    end
+
+target("fripack-harness")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/harness.cc")
+    add_packages("fmt", "xz")
+    add_ldflags("-rdynamic")
+    add_syslinks("pthread", "dl")
+    add_deps("fripack-inject")
+    if not is_plat("linux") then
+        set_enabled(false)
+    end
+
+target("fripack-trace-decode")
+    set_kind("binary")
+    set_default(false)
+    add_files("tools/trace_decode.cc")
+    add_includedirs("src")
+    add_packages("fmt")
+
+target("fripack-metrics-read")
+    set_kind("binary")
+    set_default(false)
+    add_files("tools/metrics_read.cc")
+    add_includedirs("src")
+    add_packages("fmt")
+    if is_plat("windows") then
+        set_enabled(false)
+    end